@@ -8,7 +8,31 @@ PREFIX        = /usr
 MANPREFIX     = ${PREFIX}/share/man
 LOCALSTATEDIR = /var/lib
 
+# USDT probes are built in whenever <sys/sdt.h> is available
+#SDTFLAGS     = -DNO_SDT
+
+# BLAKE2s compression written with GCC/Clang vector extensions, which
+# the compiler lowers to SSE, NEON or RVV; `seedrng bench' checks it
+# against the scalar one
+#BLAKE2SFLAGS = -DBLAKE2S_VECTOR
+
 # flags
-CPPFLAGS      = -D_DEFAULT_SOURCE -DLOCALSTATEDIR=\"${LOCALSTATEDIR}\"
-CFLAGS        = -pedantic -Wall -Wextra -Wformat ${CPPFLAGS}
-LDFLAGS       = -static
+CPPFLAGS      = -D_DEFAULT_SOURCE -DVERSION=\"${VERSION}\" \
+                -DLOCALSTATEDIR=\"${LOCALSTATEDIR}\" ${SDTFLAGS} \
+                ${BLAKE2SFLAGS}
+CFLAGS        = -pedantic -Wall -Wextra -Wformat -pthread ${CPPFLAGS}
+LDFLAGS       = -static -pthread
+
+# freestanding build without libc, see nolibc.c
+NOLIBC_CFLAGS = -pedantic -Wall -Wextra -Wformat -Os -ffreestanding \
+                -fno-stack-protector -fno-asynchronous-unwind-tables \
+                -fno-tree-loop-distribute-patterns \
+                ${CPPFLAGS} -DSEEDRNG_NOLIBC -D__NO_CTYPE
+NOLIBC_LDFLAGS = -static -nostdlib -s
+
+# kernel behaviours exercised by `make simbench', see kernelsim.h
+SIM_SCENARIOS = default enosys notready eintr=1000 short=7 \
+                fsync_ms=20 latency_us=500 notready,fsync_ms=20
+
+# runs of `seedrng --version' timed by `make sizes'
+SIZES_RUNS    = 1000
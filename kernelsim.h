@@ -0,0 +1,196 @@
+//! \file  kernelsim.h
+//! \brief Kernel stand-in for running seedrng unprivileged.
+//!
+//! Only included when building with -DSEEDRNG_SIM.  The kernel facing
+//! calls made by seedrng.c are redirected to the functions below, which
+//! simulate the kernel behaviours selected by the comma separated
+//! SEEDRNG_SIM environment variable:
+//!
+//!   default        a working kernel with an initialized CRNG
+//!   enosys         getrandom(2) fails with ENOSYS
+//!   notready       the CRNG is not initialized yet
+//!   eintr=N        the first N getrandom(2) and read(2) calls fail
+//!                  with EINTR
+//!   short=N        getrandom(2) and read(2) return at most N bytes
+//!   latency_us=N   every getrandom(2) and RNDADDENTROPY call takes N
+//!                  microseconds
+//!   fsync_ms=N     every fsync(2) takes N milliseconds
+//!
+//! RNDADDENTROPY never reaches the kernel, seeds are kept below
+//! SEEDRNG_SIM_DIR instead of SEED_DIR and staged below
+//! SEEDRNG_SIM_RUN_DIR instead of RUN_DIR, and the root check is skipped.
+//! The wall time of the whole run is reported on exit, so every
+//! scenario doubles as an end-to-end benchmark.
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+struct kernelsim {
+	const char *scenario;
+	int enosys;
+	int notready;
+	unsigned long eintr;
+	unsigned long short_len;
+	unsigned long latency_us;
+	unsigned long fsync_ms;
+	unsigned long getrandom_calls;
+	unsigned long eintr_injected;
+	unsigned long seeded_bytes;
+	unsigned long credited_bits;
+	struct timespec start;
+};
+
+static struct kernelsim sim;
+
+static void sim_sleep_us(unsigned long us)
+{
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000
+	};
+
+	while (us && nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+static int sim_inject_eintr(void)
+{
+	if (sim.eintr_injected >= sim.eintr)
+		return 0;
+	++sim.eintr_injected;
+	errno = EINTR;
+	return 1;
+}
+
+static void sim_report(void)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "sim: scenario \"%s\": %.3f ms wall, %lu bytes seeded, "
+		"%lu bits credited, %lu getrandom calls, %lu EINTR injected\n",
+		sim.scenario,
+		(end.tv_sec - sim.start.tv_sec) * 1e3 +
+		(end.tv_nsec - sim.start.tv_nsec) / 1e6,
+		sim.seeded_bytes, sim.credited_bits, sim.getrandom_calls, sim.eintr_injected);
+}
+
+__attribute__((constructor)) static void sim_init(void)
+{
+	static char scenario[256];
+	char *opt, *saveptr = NULL;
+	const char *env = getenv("SEEDRNG_SIM");
+
+	clock_gettime(CLOCK_MONOTONIC, &sim.start);
+	sim.scenario = env && *env ? env : "default";
+	if (env) {
+		strncpy(scenario, env, sizeof(scenario) - 1);
+		for (opt = strtok_r(scenario, ",", &saveptr); opt;
+		     opt = strtok_r(NULL, ",", &saveptr)) {
+			if (!strcmp(opt, "default"))
+				continue;
+			else if (!strcmp(opt, "enosys"))
+				sim.enosys = 1;
+			else if (!strcmp(opt, "notready"))
+				sim.notready = 1;
+			else if (!strncmp(opt, "eintr=", 6))
+				sim.eintr = strtoul(opt + 6, NULL, 10);
+			else if (!strncmp(opt, "short=", 6))
+				sim.short_len = strtoul(opt + 6, NULL, 10);
+			else if (!strncmp(opt, "latency_us=", 11))
+				sim.latency_us = strtoul(opt + 11, NULL, 10);
+			else if (!strncmp(opt, "fsync_ms=", 9))
+				sim.fsync_ms = strtoul(opt + 9, NULL, 10);
+			else
+				fprintf(stderr, "sim: ignoring unknown option \"%s\"\n", opt);
+		}
+	}
+	atexit(sim_report);
+}
+
+static ssize_t sim_getrandom(void *buf, size_t count, unsigned int flags)
+{
+	++sim.getrandom_calls;
+	sim_sleep_us(sim.latency_us);
+	if (sim.enosys) {
+		errno = ENOSYS;
+		return -1;
+	}
+	if (sim.notready && (flags & GRND_NONBLOCK)) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (sim_inject_eintr())
+		return -1;
+	if (sim.short_len && count > sim.short_len)
+		count = sim.short_len;
+	return getrandom(buf, count, flags & ~GRND_NONBLOCK);
+}
+
+static ssize_t sim_read(int fd, void *buf, size_t count)
+{
+	if (sim_inject_eintr())
+		return -1;
+	if (sim.short_len && count > sim.short_len)
+		count = sim.short_len;
+	return read(fd, buf, count);
+}
+
+static int sim_fsync(int fd)
+{
+	sim_sleep_us(sim.fsync_ms * 1000);
+	return fsync(fd);
+}
+
+/* The only zero timeout poll is the readiness check of /dev/random. */
+static int sim_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	if (!timeout && sim.notready)
+		return 0;
+	return poll(fds, nfds, timeout);
+}
+
+static int sim_ioctl(int fd, unsigned long request, void *arg)
+{
+	const struct rand_pool_info *info = arg;
+
+	(void)fd;
+	if (request != RNDADDENTROPY) {
+		errno = ENOTTY;
+		return -1;
+	}
+	sim_sleep_us(sim.latency_us);
+	sim.seeded_bytes += info->buf_size;
+	sim.credited_bits += info->entropy_count;
+	return 0;
+}
+
+static const char *sim_seed_dir(void)
+{
+	const char *dir = getenv("SEEDRNG_SIM_DIR");
+
+	return dir && *dir ? dir : SEED_DIR;
+}
+
+static const char *sim_run_dir(void)
+{
+	const char *dir = getenv("SEEDRNG_SIM_RUN_DIR");
+
+	return dir && *dir ? dir : RUN_DIR;
+}
+
+#define getrandom(buf, count, flags) sim_getrandom(buf, count, flags)
+#define read(fd, buf, count)         sim_read(fd, buf, count)
+#define fsync(fd)                    sim_fsync(fd)
+#define poll(fds, nfds, timeout)     sim_poll(fds, nfds, timeout)
+#define ioctl(fd, request, arg)      sim_ioctl(fd, request, arg)
+#define getuid()                     0
+#define seed_dir()                   sim_seed_dir()
+#define run_dir()                    sim_run_dir()
+
+// End of file.
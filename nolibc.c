@@ -0,0 +1,1176 @@
+// SPDX-License-Identifier: (GPL-2.0 OR Apache-2.0 OR MIT OR BSD-1-Clause OR CC0-1.0)
+//! \file  nolibc.c
+//! \brief Freestanding stand-in for the parts of libc seedrng uses.
+//!
+//! Linked instead of libc by `make seedrng-nolibc'.  The libc headers
+//! are still used for types, constants and prototypes, but every
+//! function seedrng.c calls is implemented here on top of raw system
+//! calls, along with the process entry point.  Only x86_64 and aarch64
+//! are supported, and the process is assumed to be single threaded.
+
+#include <linux/random.h>
+#include <sys/random.h>
+#include <sys/auxv.h>
+#include <sys/ioctl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/timerfd.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * System calls.
+ */
+
+#if defined(__x86_64__)
+static long raw_syscall(long n, long a1, long a2, long a3, long a4, long a5,
+			long a6)
+{
+	register long r10 __asm__("r10") = a4;
+	register long r8 __asm__("r8") = a5;
+	register long r9 __asm__("r9") = a6;
+	long ret;
+
+	__asm__ volatile ("syscall"
+			  : "=a"(ret)
+			  : "a"(n), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8), "r"(r9)
+			  : "rcx", "r11", "memory");
+	return ret;
+}
+
+__asm__(".text\n"
+	".global _start\n"
+	"_start:\n"
+	"	xor %ebp, %ebp\n"
+	"	mov %rsp, %rdi\n"
+	"	and $-16, %rsp\n"
+	"	call nolibc_start\n"
+	"	hlt\n");
+#elif defined(__aarch64__)
+static long raw_syscall(long n, long a1, long a2, long a3, long a4, long a5,
+			long a6)
+{
+	register long x8 __asm__("x8") = n;
+	register long x0 __asm__("x0") = a1;
+	register long x1 __asm__("x1") = a2;
+	register long x2 __asm__("x2") = a3;
+	register long x3 __asm__("x3") = a4;
+	register long x4 __asm__("x4") = a5;
+	register long x5 __asm__("x5") = a6;
+
+	__asm__ volatile ("svc #0"
+			  : "+r"(x0)
+			  : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5)
+			  : "memory");
+	return x0;
+}
+
+__asm__(".text\n"
+	".global _start\n"
+	"_start:\n"
+	"	mov x29, #0\n"
+	"	mov x30, #0\n"
+	"	mov x0, sp\n"
+	"	and x1, x0, #-16\n"
+	"	mov sp, x1\n"
+	"	bl nolibc_start\n");
+#else
+# error "nolibc.c supports x86_64 and aarch64 only"
+#endif
+
+static int errno_value;
+static char **environment;
+static unsigned long *auxv;
+
+int *__errno_location(void)
+{
+	return &errno_value;
+}
+
+/* Converts a raw -errno return into the libc convention. */
+static long check(long ret)
+{
+	if (ret < 0 && ret > -4096) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+#define SYSCALL6(n, a, b, c, d, e, f) \
+	check(raw_syscall(n, (long)(a), (long)(b), (long)(c), (long)(d), \
+			  (long)(e), (long)(f)))
+#define SYSCALL4(n, a, b, c, d) SYSCALL6(n, a, b, c, d, 0, 0)
+#define SYSCALL3(n, a, b, c)    SYSCALL6(n, a, b, c, 0, 0, 0)
+#define SYSCALL2(n, a, b)       SYSCALL6(n, a, b, 0, 0, 0, 0)
+#define SYSCALL1(n, a)          SYSCALL6(n, a, 0, 0, 0, 0, 0)
+#define SYSCALL0(n)             SYSCALL6(n, 0, 0, 0, 0, 0, 0)
+
+long syscall(long n, ...)
+{
+	long a[6];
+	va_list ap;
+	int i;
+
+	va_start(ap, n);
+	for (i = 0; i < 6; ++i)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+	return SYSCALL6(n, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void exit(int status)
+{
+	for (;;)
+		raw_syscall(SYS_exit_group, status, 0, 0, 0, 0, 0);
+}
+
+void _exit(int status)
+{
+	exit(status);
+}
+
+pid_t fork(void)
+{
+	return SYSCALL2(SYS_clone, SIGCHLD, 0);
+}
+
+pid_t waitpid(pid_t pid, int *status, int options)
+{
+	return SYSCALL4(SYS_wait4, pid, status, options, NULL);
+}
+
+pid_t setsid(void)
+{
+	return SYSCALL0(SYS_setsid);
+}
+
+int openat(int dfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return SYSCALL4(SYS_openat, dfd, path, flags, mode);
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & O_CREAT) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+	return openat(AT_FDCWD, path, flags, mode);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	return SYSCALL3(SYS_read, fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	return SYSCALL3(SYS_write, fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+	return SYSCALL4(SYS_pread64, fd, buf, count, offset);
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	return SYSCALL4(SYS_pwrite64, fd, buf, count, offset);
+}
+
+int close(int fd)
+{
+	return SYSCALL1(SYS_close, fd);
+}
+
+int fsync(int fd)
+{
+	return SYSCALL1(SYS_fsync, fd);
+}
+
+int fdatasync(int fd)
+{
+	return SYSCALL1(SYS_fdatasync, fd);
+}
+
+int ftruncate(int fd, off_t length)
+{
+	return SYSCALL2(SYS_ftruncate, fd, length);
+}
+
+int fstat(int fd, struct stat *st)
+{
+	return SYSCALL2(SYS_fstat, fd, st);
+}
+
+int fstatat(int dfd, const char *path, struct stat *st, int flags)
+{
+	return SYSCALL4(SYS_newfstatat, dfd, path, st, flags);
+}
+
+int fstatfs(int fd, struct statfs *st)
+{
+	return SYSCALL2(SYS_fstatfs, fd, st);
+}
+
+int dup2(int oldfd, int newfd)
+{
+	if (oldfd == newfd)
+		return newfd;
+	return SYSCALL3(SYS_dup3, oldfd, newfd, 0);
+}
+
+int flock(int fd, int operation)
+{
+	return SYSCALL2(SYS_flock, fd, operation);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	void *arg;
+	va_list ap;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+	return SYSCALL3(SYS_ioctl, fd, request, arg);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+	va_list ap;
+	long arg;
+
+	va_start(ap, cmd);
+	arg = va_arg(ap, long);
+	va_end(ap);
+	return SYSCALL3(SYS_fcntl, fd, cmd, arg);
+}
+
+ssize_t getrandom(void *buf, size_t count, unsigned int flags)
+{
+	return SYSCALL3(SYS_getrandom, buf, count, flags);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	struct timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000L
+	};
+
+	return SYSCALL6(SYS_ppoll, fds, nfds, timeout < 0 ? NULL : &ts, NULL, 0, 0);
+}
+
+int epoll_create1(int flags)
+{
+	return SYSCALL1(SYS_epoll_create1, flags);
+}
+
+int epoll_ctl(int efd, int op, int fd, struct epoll_event *ev)
+{
+	return SYSCALL4(SYS_epoll_ctl, efd, op, fd, ev);
+}
+
+int epoll_wait(int efd, struct epoll_event *events, int maxevents, int timeout)
+{
+	return SYSCALL6(SYS_epoll_pwait, efd, events, maxevents, timeout, NULL, 0);
+}
+
+int mlock(const void *addr, size_t len)
+{
+	return SYSCALL2(SYS_mlock, addr, len);
+}
+
+/* The kernel's sigset_t is a single word, glibc's is much larger. */
+int sigemptyset(sigset_t *set)
+{
+	memset(set, 0, sizeof(*set));
+	return 0;
+}
+
+int sigaddset(sigset_t *set, int sig)
+{
+	size_t bits = 8 * sizeof(long);
+
+	set->__val[(sig - 1) / bits] |= 1UL << ((sig - 1) % bits);
+	return 0;
+}
+
+int sigprocmask(int how, const sigset_t *set, sigset_t *old)
+{
+	return SYSCALL4(SYS_rt_sigprocmask, how, set, old, sizeof(long));
+}
+
+int signalfd(int fd, const sigset_t *mask, int flags)
+{
+	return SYSCALL4(SYS_signalfd4, fd, mask, sizeof(long), flags);
+}
+
+int timerfd_create(clockid_t clock, int flags)
+{
+	return SYSCALL2(SYS_timerfd_create, clock, flags);
+}
+
+int timerfd_settime(int fd, int flags, const struct itimerspec *new,
+		    struct itimerspec *old)
+{
+	return SYSCALL4(SYS_timerfd_settime, fd, flags, new, old);
+}
+
+int mkdirat(int dfd, const char *path, mode_t mode)
+{
+	return SYSCALL3(SYS_mkdirat, dfd, path, mode);
+}
+
+int mkdir(const char *path, mode_t mode)
+{
+	return mkdirat(AT_FDCWD, path, mode);
+}
+
+int unlinkat(int dfd, const char *path, int flags)
+{
+	return SYSCALL3(SYS_unlinkat, dfd, path, flags);
+}
+
+int unlink(const char *path)
+{
+	return unlinkat(AT_FDCWD, path, 0);
+}
+
+int renameat(int olddfd, const char *oldpath, int newdfd, const char *newpath)
+{
+	return SYSCALL6(SYS_renameat2, olddfd, oldpath, newdfd, newpath, 0, 0);
+}
+
+int rename(const char *oldpath, const char *newpath)
+{
+	return renameat(AT_FDCWD, oldpath, AT_FDCWD, newpath);
+}
+
+int clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	return SYSCALL2(SYS_clock_gettime, clock, ts);
+}
+
+mode_t umask(mode_t mask)
+{
+	return SYSCALL1(SYS_umask, mask);
+}
+
+uid_t getuid(void)
+{
+	return SYSCALL0(SYS_getuid);
+}
+
+pid_t getpid(void)
+{
+	return SYSCALL0(SYS_getpid);
+}
+
+int sched_getscheduler(pid_t pid)
+{
+	return SYSCALL1(SYS_sched_getscheduler, pid);
+}
+
+int sched_setscheduler(pid_t pid, int policy, const struct sched_param *param)
+{
+	return SYSCALL3(SYS_sched_setscheduler, pid, policy, param);
+}
+
+int sched_getparam(pid_t pid, struct sched_param *param)
+{
+	return SYSCALL2(SYS_sched_getparam, pid, param);
+}
+
+/* The system call returns 20 - nice, so that it never looks like -errno. */
+int getpriority(__priority_which_t which, id_t who)
+{
+	long ret = SYSCALL2(SYS_getpriority, which, who);
+
+	return ret < 0 ? -1 : 20 - ret;
+}
+
+int setpriority(__priority_which_t which, id_t who, int prio)
+{
+	return SYSCALL3(SYS_setpriority, which, who, prio);
+}
+
+int getrusage(__rusage_who_t who, struct rusage *usage)
+{
+	return SYSCALL2(SYS_getrusage, who, usage);
+}
+
+int uname(struct utsname *buf)
+{
+	return SYSCALL1(SYS_uname, buf);
+}
+
+/*
+ * Memory.  Every allocation is its own anonymous mapping, preceded by
+ * its size.  seedrng only allocates a handful of small buffers.
+ */
+
+void *malloc(size_t size)
+{
+	size_t *p;
+
+	if (size > SIZE_MAX - 16) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	p = (size_t *)SYSCALL6(SYS_mmap, NULL, size + 16, PROT_READ | PROT_WRITE,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	*p = size + 16;
+	return (uint8_t *)p + 16;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	if (size && nmemb > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return malloc(nmemb * size);	/* anonymous mappings are zeroed */
+}
+
+void free(void *ptr)
+{
+	size_t *p = (size_t *)((uint8_t *)ptr - 16);
+
+	if (ptr)
+		raw_syscall(SYS_munmap, (long)p, *p, 0, 0, 0, 0);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	size_t old = ptr ? *(size_t *)((uint8_t *)ptr - 16) - 16 : 0;
+	void *p = malloc(size);
+
+	if (p && ptr) {
+		memcpy(p, ptr, old < size ? old : size);
+		free(ptr);
+	}
+	return p;
+}
+
+/* Insertion sort, for the few names in the spool directory. */
+void qsort(void *base, size_t nmemb, size_t size,
+	   int (*compar)(const void *, const void *))
+{
+	uint8_t *a = base, *x, *y, tmp;
+	size_t i, j, k;
+
+	for (i = 1; i < nmemb; ++i) {
+		for (j = i; j > 0; --j) {
+			x = a + (j - 1) * size;
+			y = a + j * size;
+			if (compar(x, y) <= 0)
+				break;
+			for (k = 0; k < size; ++k) {
+				tmp = x[k];
+				x[k] = y[k];
+				y[k] = tmp;
+			}
+		}
+	}
+}
+
+/*
+ * Strings.
+ */
+
+void *memcpy(void *dst, const void *src, size_t n)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	while (n--)
+		*d++ = *s++;
+	return dst;
+}
+
+void *memmove(void *dst, const void *src, size_t n)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	if (d < s)
+		return memcpy(dst, src, n);
+	while (n--)
+		d[n] = s[n];
+	return dst;
+}
+
+void *memset(void *dst, int c, size_t n)
+{
+	uint8_t *d = dst;
+
+	while (n--)
+		*d++ = c;
+	return dst;
+}
+
+int memcmp(const void *a, const void *b, size_t n)
+{
+	const uint8_t *x = a, *y = b;
+
+	for (; n; --n, ++x, ++y) {
+		if (*x != *y)
+			return *x - *y;
+	}
+	return 0;
+}
+
+size_t strlen(const char *s)
+{
+	const char *p = s;
+
+	while (*p)
+		++p;
+	return p - s;
+}
+
+int strncmp(const char *a, const char *b, size_t n)
+{
+	for (; n; --n, ++a, ++b) {
+		if (*a != *b || !*a)
+			return (unsigned char)*a - (unsigned char)*b;
+	}
+	return 0;
+}
+
+int strcmp(const char *a, const char *b)
+{
+	return strncmp(a, b, SIZE_MAX);
+}
+
+int tolower(int c)
+{
+	return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+int isspace(int c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+int strcasecmp(const char *a, const char *b)
+{
+	for (; tolower(*a) == tolower(*b); ++a, ++b) {
+		if (!*a)
+			return 0;
+	}
+	return tolower((unsigned char)*a) - tolower((unsigned char)*b);
+}
+
+char *strchr(const char *s, int c)
+{
+	for (; *s != (char)c; ++s) {
+		if (!*s)
+			return NULL;
+	}
+	return (char *)s;
+}
+
+size_t strcspn(const char *s, const char *reject)
+{
+	size_t n = 0;
+
+	while (s[n] && !strchr(reject, s[n]))
+		++n;
+	return n;
+}
+
+size_t strspn(const char *s, const char *accept)
+{
+	size_t n = 0;
+
+	while (s[n] && strchr(accept, s[n]))
+		++n;
+	return n;
+}
+
+char *strncpy(char *dst, const char *src, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n && src[i]; ++i)
+		dst[i] = src[i];
+	for (; i < n; ++i)
+		dst[i] = '\0';
+	return dst;
+}
+
+char *strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = malloc(len);
+
+	return p ? memcpy(p, s, len) : NULL;
+}
+
+char *strtok_r(char *str, const char *delim, char **saveptr)
+{
+	char *end;
+
+	if (!str)
+		str = *saveptr;
+	str += strspn(str, delim);
+	if (!*str) {
+		*saveptr = str;
+		return NULL;
+	}
+	end = str + strcspn(str, delim);
+	if (*end)
+		*end++ = '\0';
+	*saveptr = end;
+	return str;
+}
+
+unsigned long strtoul(const char *s, char **end, int base)
+{
+	unsigned long ret = 0;
+	int digit;
+
+	while (isspace(*s))
+		++s;
+	if (*s == '+')
+		++s;
+	if (!base)
+		base = 10;
+	for (;; ++s) {
+		if (*s >= '0' && *s <= '9')
+			digit = *s - '0';
+		else if (tolower(*s) >= 'a' && tolower(*s) <= 'z')
+			digit = tolower(*s) - 'a' + 10;
+		else
+			break;
+		if (digit >= base)
+			break;
+		ret = ret * base + digit;
+	}
+	if (end)
+		*end = (char *)s;
+	return ret;
+}
+
+long strtol(const char *s, char **end, int base)
+{
+	while (isspace(*s))
+		++s;
+	if (*s == '-')
+		return -(long)strtoul(s + 1, end, base);
+	return strtoul(s, end, base);
+}
+
+char *getenv(const char *name)
+{
+	size_t len = strlen(name);
+	char **env;
+
+	for (env = environment; env && *env; ++env) {
+		if (!strncmp(*env, name, len) && (*env)[len] == '=')
+			return *env + len + 1;
+	}
+	return NULL;
+}
+
+unsigned long getauxval(unsigned long type)
+{
+	unsigned long *aux;
+
+	for (aux = auxv; aux && aux[0] != AT_NULL; aux += 2) {
+		if (aux[0] == type)
+			return aux[1];
+	}
+	errno = ENOENT;
+	return 0;
+}
+
+char *strerror(int errnum)
+{
+	static const struct {
+		int errnum;
+		const char *msg;
+	} messages[] = {
+		{ EPERM,   "Operation not permitted" },
+		{ ENOENT,  "No such file or directory" },
+		{ EINTR,   "Interrupted system call" },
+		{ EIO,     "Input/output error" },
+		{ EBADF,   "Bad file descriptor" },
+		{ EAGAIN,  "Resource temporarily unavailable" },
+		{ ENOMEM,  "Cannot allocate memory" },
+		{ EACCES,  "Permission denied" },
+		{ EBUSY,   "Device or resource busy" },
+		{ EEXIST,  "File exists" },
+		{ ENOTDIR, "Not a directory" },
+		{ EISDIR,  "Is a directory" },
+		{ EINVAL,  "Invalid argument" },
+		{ ENOTTY,  "Inappropriate ioctl for device" },
+		{ EFBIG,   "File too large" },
+		{ ENOSPC,  "No space left on device" },
+		{ EROFS,   "Read-only file system" },
+		{ ENOSYS,  "Function not implemented" },
+		{ ELOOP,   "Too many levels of symbolic links" },
+		{ EDQUOT,  "Disk quota exceeded" }
+	};
+	static char unknown[32];
+	size_t i;
+
+	for (i = 0; i < sizeof(messages) / sizeof(messages[0]); ++i) {
+		if (messages[i].errnum == errnum)
+			return (char *)messages[i].msg;
+	}
+	snprintf(unknown, sizeof(unknown), "Unknown error %d", errnum);
+	return unknown;
+}
+
+/*
+ * Formatted output: flags "-+ 0", width, precision, the h, l, ll and z
+ * length modifiers, and the d, i, u, x, X, c, s, p, f and % conversions.
+ */
+
+struct outbuf {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static void out_char(struct outbuf *out, char c)
+{
+	if (out->len + 1 < out->size)
+		out->buf[out->len] = c;
+	++out->len;
+}
+
+static void out_field(struct outbuf *out, const char *prefix,
+		      const char *body, size_t body_len, int width, bool left,
+		      bool zero)
+{
+	size_t prefix_len = strlen(prefix), len = prefix_len + body_len, i;
+
+	if (!left && !zero)
+		for (; width > 0 && (size_t)width > len; --width)
+			out_char(out, ' ');
+	for (i = 0; i < prefix_len; ++i)
+		out_char(out, prefix[i]);
+	if (!left && zero)
+		for (; width > 0 && (size_t)width > len; --width)
+			out_char(out, '0');
+	for (i = 0; i < body_len; ++i)
+		out_char(out, body[i]);
+	if (left)
+		for (; width > 0 && (size_t)width > len; --width)
+			out_char(out, ' ');
+}
+
+static size_t format_unsigned(char *end, unsigned long long v,
+			      unsigned int base, bool upper, int min_digits)
+{
+	const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char *p = end;
+
+	while (v || min_digits > 0) {
+		*--p = digits[v % base];
+		v /= base;
+		--min_digits;
+	}
+	return end - p;
+}
+
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+	struct outbuf out = { .buf = buf, .size = size };
+	char num[64], *end = num + sizeof(num);
+	const char *prefix, *s;
+	unsigned long long u;
+	long long d;
+	double f;
+	int width, prec, length;
+	bool left, zero, plus, space;
+	size_t n;
+
+	for (; *fmt; ++fmt) {
+		if (*fmt != '%') {
+			out_char(&out, *fmt);
+			continue;
+		}
+		left = zero = plus = space = false;
+		for (;; ++fmt) {
+			if (fmt[1] == '-')
+				left = true;
+			else if (fmt[1] == '0')
+				zero = true;
+			else if (fmt[1] == '+')
+				plus = true;
+			else if (fmt[1] == ' ')
+				space = true;
+			else
+				break;
+		}
+		++fmt;
+		width = 0;
+		if (*fmt == '*') {
+			width = va_arg(ap, int);
+			++fmt;
+		}
+		while (*fmt >= '0' && *fmt <= '9')
+			width = width * 10 + *fmt++ - '0';
+		prec = -1;
+		if (*fmt == '.') {
+			prec = 0;
+			while (*++fmt >= '0' && *fmt <= '9')
+				prec = prec * 10 + *fmt - '0';
+		}
+		length = 0;
+		for (;; ++fmt) {
+			if (*fmt == 'l')
+				++length;
+			else if (*fmt == 'z')
+				length = 1;
+			else if (*fmt != 'h')
+				break;
+		}
+
+		prefix = "";
+		switch (*fmt) {
+		case 'd':
+		case 'i':
+			d = length >= 2 ? va_arg(ap, long long) :
+			    length ? va_arg(ap, long) : va_arg(ap, int);
+			u = d < 0 ? -(unsigned long long)d : (unsigned long long)d;
+			prefix = d < 0 ? "-" : plus ? "+" : space ? " " : "";
+			n = format_unsigned(end, u, 10, false, prec < 0 ? 1 : prec);
+			out_field(&out, prefix, end - n, n, width, left, zero && prec < 0);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+			u = length >= 2 ? va_arg(ap, unsigned long long) :
+			    length ? va_arg(ap, unsigned long) :
+			    va_arg(ap, unsigned int);
+			n = format_unsigned(end, u, *fmt == 'u' ? 10 : 16,
+					    *fmt == 'X', prec < 0 ? 1 : prec);
+			out_field(&out, prefix, end - n, n, width, left, zero && prec < 0);
+			break;
+		case 'p':
+			u = (uintptr_t)va_arg(ap, void *);
+			n = format_unsigned(end, u, 16, false, 1);
+			out_field(&out, "0x", end - n, n, width, left, false);
+			break;
+		case 'c':
+			num[0] = va_arg(ap, int);
+			out_field(&out, prefix, num, 1, width, left, false);
+			break;
+		case 's':
+			s = va_arg(ap, const char *);
+			if (!s)
+				s = "(null)";
+			for (n = 0; s[n] && (prec < 0 || n < (size_t)prec); ++n)
+				;
+			out_field(&out, prefix, s, n, width, left, false);
+			break;
+		case 'f':
+			f = va_arg(ap, double);
+			if (prec < 0)
+				prec = 6;
+			if (prec > 9)
+				prec = 9;
+			prefix = f < 0 ? "-" : plus ? "+" : space ? " " : "";
+			if (f < 0)
+				f = -f;
+			if (f != f || f >= 1e18) {
+				out_field(&out, prefix, f != f ? "nan" : "inf", 3, width, left, false);
+				break;
+			}
+			for (d = 1, n = prec; n; --n)
+				d *= 10;
+			u = (unsigned long long)(f * d + 0.5);
+			n = 0;
+			if (prec) {
+				n = format_unsigned(end, u % d, 10, false, prec);
+				*(end - n - 1) = '.';
+				++n;
+			}
+			n += format_unsigned(end - n, u / d, 10, false, 1);
+			out_field(&out, prefix, end - n, n, width, left, zero);
+			break;
+		case '%':
+			out_char(&out, '%');
+			break;
+		default:
+			out_char(&out, '%');
+			if (*fmt)
+				out_char(&out, *fmt);
+			else
+				--fmt;
+		}
+	}
+	if (size)
+		buf[out.len < size ? out.len : size - 1] = '\0';
+	return out.len;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, size, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+/* Stream identities only; output is never buffered. */
+static FILE stdout_file, stderr_file;
+FILE *stdout = &stdout_file;
+FILE *stderr = &stderr_file;
+
+int vfprintf(FILE *stream, const char *fmt, va_list ap)
+{
+	char buf[1024];
+	va_list copy;
+	int len;
+
+	va_copy(copy, ap);
+	len = vsnprintf(buf, sizeof(buf), fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return len;
+	if (write(stream == stderr ? STDERR_FILENO : STDOUT_FILENO, buf,
+		  (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1) < 0)
+		return -1;
+	return len;
+}
+
+int fprintf(FILE *stream, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(stream, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+int printf(const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(stdout, fmt, ap);
+	va_end(ap);
+	return ret;
+}
+
+void perror(const char *msg)
+{
+	int err = errno;
+
+	if (msg && *msg)
+		fprintf(stderr, "%s: %s\n", msg, strerror(err));
+	else
+		fprintf(stderr, "%s\n", strerror(err));
+	errno = err;
+}
+
+/*
+ * Directories.
+ */
+
+struct __dirstream {
+	int fd;
+	size_t pos, len;
+	uint8_t buf[4096] __attribute__((aligned(8)));
+};
+
+DIR *fdopendir(int fd)
+{
+	DIR *dir = calloc(1, sizeof(*dir));
+
+	if (dir)
+		dir->fd = fd;
+	return dir;
+}
+
+/* struct dirent matches the kernel's struct linux_dirent64 on 64-bit. */
+struct dirent *readdir(DIR *dir)
+{
+	struct dirent *ent;
+	long len;
+
+	if (dir->pos >= dir->len) {
+		len = SYSCALL3(SYS_getdents64, dir->fd, dir->buf, sizeof(dir->buf));
+		if (len <= 0)
+			return NULL;
+		dir->len = len;
+		dir->pos = 0;
+	}
+	ent = (struct dirent *)(dir->buf + dir->pos);
+	dir->pos += ent->d_reclen;
+	return ent;
+}
+
+int closedir(DIR *dir)
+{
+	int ret = close(dir->fd);
+
+	free(dir);
+	return ret;
+}
+
+/*
+ * Options, in the subset getopt_long(3) that seedrng needs: clustered
+ * short options without arguments, and long options.  Parsing stops at
+ * the first non-option, as with POSIXLY_CORRECT.
+ */
+
+char *optarg;
+int optind = 1, opterr = 1, optopt;
+
+int getopt_long(int argc, char *const argv[], const char *optstring,
+		const struct option *longopts, int *longindex)
+{
+	static int next = 1;
+	const struct option *o;
+	const char *arg, *p;
+	size_t len;
+
+	optarg = NULL;
+	if (optind >= argc || argv[optind][0] != '-' || !argv[optind][1])
+		return -1;
+	arg = argv[optind];
+	if (!strcmp(arg, "--")) {
+		++optind;
+		return -1;
+	}
+	if (arg[1] == '-') {
+		++optind;
+		len = strcspn(arg + 2, "=");
+		for (o = longopts; o && o->name; ++o) {
+			if (strlen(o->name) != len || strncmp(o->name, arg + 2, len))
+				continue;
+			if (longindex)
+				*longindex = o - longopts;
+			if (o->has_arg != no_argument) {
+				if (arg[2 + len] == '=')
+					optarg = (char *)arg + 3 + len;
+				else if (o->has_arg == required_argument && optind < argc)
+					optarg = argv[optind++];
+				else if (o->has_arg == required_argument) {
+					if (opterr)
+						fprintf(stderr, "%s: option '%s' requires an argument\n", argv[0], arg);
+					return '?';
+				}
+			} else if (arg[2 + len] == '=') {
+				if (opterr)
+					fprintf(stderr, "%s: option '--%s' doesn't "
+						"allow an argument\n", argv[0], o->name);
+				return '?';
+			}
+			if (o->flag) {
+				*o->flag = o->val;
+				return 0;
+			}
+			return o->val;
+		}
+		if (opterr)
+			fprintf(stderr, "%s: unrecognized option '%s'\n", argv[0], arg);
+		return '?';
+	}
+
+	optopt = arg[next];
+	p = strchr(optstring, optopt);
+	if (!arg[++next]) {
+		++optind;
+		next = 1;
+	}
+	if (!p || optopt == ':') {
+		if (opterr)
+			fprintf(stderr, "%s: invalid option -- '%c'\n", argv[0], optopt);
+		return '?';
+	}
+	if (p[1] == ':') {
+		if (next > 1) {
+			optarg = (char *)arg + next;
+			++optind;
+			next = 1;
+		} else if (optind < argc)
+			optarg = argv[optind++];
+		else {
+			if (opterr)
+				fprintf(stderr, "%s: option requires an "
+					"argument -- '%c'\n", argv[0], optopt);
+			return '?';
+		}
+	}
+	return optopt;
+}
+
+int getopt(int argc, char *const argv[], const char *optstring)
+{
+	return getopt_long(argc, argv, optstring, NULL, NULL);
+}
+
+/*
+ * Entry point.
+ */
+
+int main(int argc, char *argv[]);
+
+__attribute__((noreturn, used)) void nolibc_start(long *sp)
+{
+	int argc = sp[0];
+	char **argv = (char **)(sp + 1);
+	char **envp;
+
+	environment = argv + argc + 1;
+	for (envp = environment; *envp; ++envp)
+		;
+	auxv = (unsigned long *)(envp + 1);
+	exit(main(argc, argv));
+}
+
+// End of file.
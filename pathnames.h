@@ -12,4 +12,34 @@
 //!< "Non-creditable" seed file.
 #define NON_CREDITABLE_SEED  "seed.no-credit"
 
+//!< Configuration file, as written by `seedrng bench -w'.
+#define CONFIG_FILE          "seedrng.conf"
+
+//!< Bounded ring of per-run performance records.
+#define HISTORY_FILE         "history"
+
+//!< Scratch file used by `seedrng bench'.
+#define BENCH_SEED           ".seed.bench"
+
+//!< Scratch file written instead of the new seed by --dry-run.
+#define DRY_RUN_SEED         ".seed.dry-run"
+
+//!< Spool directory for seed fragments dropped by other programs.
+#define SPOOL_DIR            "spool.d"
+
+//!< Filename suffix marking a spooled fragment as creditable.
+#define SPOOL_CREDIT_SUFFIX  ".credit"
+
+//!< Runtime directory for seeds staged while SEED_DIR is read-only.
+#define RUN_DIR              "/run/seedrng"
+
+//!< Seed staged in RUN_DIR, with the tombstones of the seeds it replaces.
+#define PENDING_FILE         "pending"
+
+//!< Lock in RUN_DIR held by the child waiting to commit the pending seed.
+#define WATCHER_LOCK         "watcher.lock"
+
+//!< Socket in RUN_DIR on which `seedrng serve' hands out seeds.
+#define SERVE_SOCKET         "serve.sock"
+
 // End of file.
@@ -4,25 +4,77 @@
  */
 
 #include <linux/random.h>
+#include <linux/perf_event.h>
 #include <sys/random.h>
+#include <sys/auxv.h>
 #include <sys/ioctl.h>
 #include <sys/file.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
 #include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#ifndef SEEDRNG_NOLIBC
+# include <pthread.h>
+#endif
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
 #include <endian.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #include "pathnames.h"
 
+#if !defined(HAVE_SDT) && !defined(NO_SDT) && defined(__has_include)
+# if __has_include(<sys/sdt.h>)
+#  define HAVE_SDT
+# endif
+#endif
+
+#ifdef HAVE_SDT
+# include <sys/sdt.h>
+# define TRACE0(name)          STAP_PROBE(seedrng, name)
+# define TRACE1(name, a)       STAP_PROBE1(seedrng, name, a)
+# define TRACE2(name, a, b)    STAP_PROBE2(seedrng, name, a, b)
+# define TRACE3(name, a, b, c) STAP_PROBE3(seedrng, name, a, b, c)
+#else
+# define TRACE0(name)          do { } while (0)
+# define TRACE1(name, a)       do { } while (0)
+# define TRACE2(name, a, b)    do { } while (0)
+# define TRACE3(name, a, b, c) do { } while (0)
+#endif
+
+#ifdef SEEDRNG_SIM
+# include "kernelsim.h"
+#else
+# define seed_dir() SEED_DIR
+# define run_dir()  RUN_DIR
+#endif
+
 enum blake2s_lengths {
 	BLAKE2S_BLOCK_LEN = 64,
 	BLAKE2S_HASH_LEN  = 32,
@@ -43,8 +95,6 @@ struct blake2s_state {
 	unsigned int outlen;
 };
 
-#define le32_to_cpup(a) le32toh(*(a))
-
 #define cpu_to_le32(a) htole32(a)
 
 #ifndef ARRAY_SIZE
@@ -63,12 +113,10 @@ static inline void cpu_to_le32_array(uint32_t *buf, unsigned int words)
 	}
 }
 
-static inline void le32_to_cpu_array(uint32_t *buf, unsigned int words)
+/* Compiles to a single load where unaligned little endian loads are. */
+static inline uint32_t get_unaligned_le32(const uint8_t *p)
 {
-	while (words--) {
-		*buf = le32_to_cpup(buf);
-		++buf;
-	}
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
 }
 
 static inline uint32_t ror32(uint32_t word, unsigned int shift)
@@ -121,7 +169,28 @@ static void blake2s_init(struct blake2s_state *state, const size_t outlen)
 	state->outlen = outlen;
 }
 
-static void blake2s_compress(struct blake2s_state *state, const uint8_t *block, size_t nblocks, const uint32_t inc)
+#ifdef BLAKE2S_VECTOR
+# define blake2s_compress blake2s_compress_vector
+#else
+# define blake2s_compress blake2s_compress_generic
+#endif
+
+static void blake2s_compress(struct blake2s_state *state, const uint8_t *block, size_t nblocks, const uint32_t inc);
+static void blake2s_update(struct blake2s_state *state, const void *inp, size_t inlen);
+
+static void blake2s_init_key(struct blake2s_state *state, const size_t outlen, const void *key, const size_t keylen)
+{
+	uint8_t block[BLAKE2S_BLOCK_LEN] = { 0 };
+
+	blake2s_init_param(state, 0x01010000 | keylen << 8 | outlen);
+	state->outlen = outlen;
+	memcpy(block, key, keylen);
+	blake2s_update(state, block, BLAKE2S_BLOCK_LEN);
+	memset(block, 0, BLAKE2S_BLOCK_LEN);
+}
+
+/* Only referenced by `seedrng bench' when the vector kernel is built. */
+__attribute__((unused)) static void blake2s_compress_generic(struct blake2s_state *state, const uint8_t *block, size_t nblocks, const uint32_t inc)
 {
 	uint32_t m[16];
 	uint32_t v[16];
@@ -129,8 +198,8 @@ static void blake2s_compress(struct blake2s_state *state, const uint8_t *block,
 
 	while (nblocks > 0) {
 		blake2s_increment_counter(state, inc);
-		memcpy(m, block, BLAKE2S_BLOCK_LEN);
-		le32_to_cpu_array(m, ARRAY_SIZE(m));
+		for (i = 0; i < 16; ++i)
+			m[i] = get_unaligned_le32(block + i * 4);
 		memcpy(v, state->h, 32);
 		v[ 8] = blake2s_iv[0];
 		v[ 9] = blake2s_iv[1];
@@ -184,6 +253,85 @@ static void blake2s_compress(struct blake2s_state *state, const uint8_t *block,
 	}
 }
 
+#ifdef BLAKE2S_VECTOR
+/*
+ * The same compression on the four rows of the state as vectors of four
+ * words, written with GCC and Clang vector extensions, so that the
+ * compiler lowers it to SSE, NEON or RVV, whichever the target has.  The
+ * four G functions of a column or diagonal step run in the four lanes,
+ * and lane rotations of three rows turn the columns into diagonals and
+ * back.
+ */
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+
+#if defined(__clang__) || __GNUC__ >= 12
+# define u32x4_shuffle(v, a, b, c, d) __builtin_shufflevector(v, v, a, b, c, d)
+#else
+# define u32x4_shuffle(v, a, b, c, d) __builtin_shuffle(v, (u32x4){ a, b, c, d })
+#endif
+
+static inline u32x4 u32x4_ror(u32x4 v, unsigned int shift)
+{
+	return v >> shift | v << (32 - shift);
+}
+
+static void blake2s_compress_vector(struct blake2s_state *state, const uint8_t *block, size_t nblocks, const uint32_t inc)
+{
+	const u32x4 iv0 = { blake2s_iv[0], blake2s_iv[1], blake2s_iv[2], blake2s_iv[3] };
+	const u32x4 iv1 = { blake2s_iv[4], blake2s_iv[5], blake2s_iv[6], blake2s_iv[7] };
+	u32x4 h0, h1, a, b, c, d;
+	const uint8_t *s;
+	uint32_t m[16];
+	int r, i;
+
+	memcpy(&h0, state->h, sizeof(h0));
+	memcpy(&h1, state->h + 4, sizeof(h1));
+	while (nblocks > 0) {
+		blake2s_increment_counter(state, inc);
+		for (i = 0; i < 16; ++i)
+			m[i] = get_unaligned_le32(block + i * 4);
+		a = h0;
+		b = h1;
+		c = iv0;
+		d = iv1 ^ (u32x4){ state->t[0], state->t[1], state->f[0], state->f[1] };
+
+#define G(x, y) do {                 \
+	a += b + (x);                \
+	d = u32x4_ror(d ^ a, 16);    \
+	c += d;                      \
+	b = u32x4_ror(b ^ c, 12);    \
+	a += b + (y);                \
+	d = u32x4_ror(d ^ a, 8);     \
+	c += d;                      \
+	b = u32x4_ror(b ^ c, 7);     \
+} while (0)
+
+		for (r = 0; r < 10; ++r) {
+			s = blake2s_sigma[r];
+			G(((u32x4){ m[s[0]], m[s[2]], m[s[4]], m[s[6]] }),
+			  ((u32x4){ m[s[1]], m[s[3]], m[s[5]], m[s[7]] }));
+			b = u32x4_shuffle(b, 1, 2, 3, 0);
+			c = u32x4_shuffle(c, 2, 3, 0, 1);
+			d = u32x4_shuffle(d, 3, 0, 1, 2);
+			G(((u32x4){ m[s[8]], m[s[10]], m[s[12]], m[s[14]] }),
+			  ((u32x4){ m[s[9]], m[s[11]], m[s[13]], m[s[15]] }));
+			b = u32x4_shuffle(b, 3, 0, 1, 2);
+			c = u32x4_shuffle(c, 2, 3, 0, 1);
+			d = u32x4_shuffle(d, 1, 2, 3, 0);
+		}
+
+#undef G
+
+		h0 ^= a ^ c;
+		h1 ^= b ^ d;
+		block += BLAKE2S_BLOCK_LEN;
+		--nblocks;
+	}
+	memcpy(state->h, &h0, sizeof(h0));
+	memcpy(state->h + 4, &h1, sizeof(h1));
+}
+#endif
+
 static void blake2s_update(struct blake2s_state *state, const void *inp, size_t inlen)
 {
 	const size_t fill = BLAKE2S_BLOCK_LEN - state->buflen;
@@ -217,6 +365,311 @@ static void blake2s_final(struct blake2s_state *state, uint8_t *out)
 	memcpy(out, state->h, state->outlen);
 }
 
+/*
+ * One-shot BLAKE2s of the concatenation of nr fields, keyed unless
+ * keylen is 0.  Whole blocks are compressed straight from the fields;
+ * only a block that straddles two fields, or ends the input and so must
+ * wait for the final flag, is gathered in the state buffer.
+ */
+static void blake2sv(uint8_t *out, size_t outlen, const void *key, size_t keylen, const struct iovec *iov, size_t nr)
+{
+	struct blake2s_state state;
+	const uint8_t *in;
+	size_t len, n, i;
+
+	if (keylen)
+		blake2s_init_key(&state, outlen, key, keylen);
+	else
+		blake2s_init(&state, outlen);
+	for (i = 0; i < nr; ++i) {
+		in = iov[i].iov_base;
+		len = iov[i].iov_len;
+		if (!len)
+			continue;
+		if (state.buflen == BLAKE2S_BLOCK_LEN) {
+			blake2s_compress(&state, state.buf, 1, BLAKE2S_BLOCK_LEN);
+			state.buflen = 0;
+		}
+		if (state.buflen) {
+			n = BLAKE2S_BLOCK_LEN - state.buflen;
+			n = len < n ? len : n;
+			memcpy(state.buf + state.buflen, in, n);
+			state.buflen += n;
+			in += n;
+			len -= n;
+			if (!len)
+				continue;
+			blake2s_compress(&state, state.buf, 1, BLAKE2S_BLOCK_LEN);
+			state.buflen = 0;
+		}
+		n = (len - 1) / BLAKE2S_BLOCK_LEN;
+		blake2s_compress(&state, in, n, BLAKE2S_BLOCK_LEN);
+		memcpy(state.buf, in + n * BLAKE2S_BLOCK_LEN, len - n * BLAKE2S_BLOCK_LEN);
+		state.buflen = len - n * BLAKE2S_BLOCK_LEN;
+	}
+	blake2s_final(&state, out);
+	memset(&state, 0, sizeof(state));
+}
+
+/*
+ * The hash a run chains everything into.  BLAKE2s hashes the input as
+ * one stream.  BLAKE2sp deals it out in 64 byte blocks, round robin, to
+ * eight BLAKE2s leaves whose hashes are hashed by a root, so that the
+ * leaves of long inputs can be hashed on several CPUs at once.
+ */
+enum hash_backend {
+	HASH_BLAKE2S,
+	HASH_BLAKE2SP,
+	NR_HASH_BACKENDS
+};
+
+static const char *const hash_backend_names[NR_HASH_BACKENDS] = {
+	[HASH_BLAKE2S]  = "blake2s",
+	[HASH_BLAKE2SP] = "blake2sp"
+};
+
+enum blake2sp_params {
+	BLAKE2SP_LEAVES     = 8,
+	BLAKE2SP_STRIPE_LEN = BLAKE2SP_LEAVES * BLAKE2S_BLOCK_LEN,
+	BLAKE2SP_THREAD_MIN = 64 * 1024	/* below this, threads cost more than they save */
+};
+
+struct seed_hash {
+	enum hash_backend backend;
+	struct blake2s_state root;
+	struct blake2s_state leaves[BLAKE2SP_LEAVES];
+	uint8_t buf[BLAKE2SP_STRIPE_LEN];
+	uint32_t buflen;
+};
+
+/* A BLAKE2sp node: 32 byte hashes, fanout 8, depth 2. */
+static void blake2sp_init_node(struct blake2s_state *state, uint32_t offset, uint32_t depth)
+{
+	blake2s_init_param(state, 0x02080000 | BLAKE2S_HASH_LEN);
+	state->h[2] ^= offset;
+	state->h[3] ^= depth << 16 | BLAKE2S_HASH_LEN << 24;
+	state->outlen = BLAKE2S_HASH_LEN;
+}
+
+/* Every step-th leaf from first on, over a run of whole stripes. */
+struct blake2sp_job {
+	struct seed_hash *hash;
+	const uint8_t *in;
+	size_t stripes;
+	unsigned int first, step;
+};
+
+static void *blake2sp_hash_leaves(void *arg)
+{
+	const struct blake2sp_job *job = arg;
+	unsigned int i;
+	size_t j;
+
+	for (i = job->first; i < BLAKE2SP_LEAVES; i += job->step) {
+		for (j = 0; j < job->stripes; ++j)
+			blake2s_update(&job->hash->leaves[i], job->in + j * BLAKE2SP_STRIPE_LEN + i * BLAKE2S_BLOCK_LEN,
+				       BLAKE2S_BLOCK_LEN);
+	}
+	return NULL;
+}
+
+static void blake2sp_hash_stripes(struct seed_hash *hash, const uint8_t *in, size_t stripes)
+{
+	struct blake2sp_job jobs[BLAKE2SP_LEAVES];
+#ifndef SEEDRNG_NOLIBC
+	pthread_t threads[BLAKE2SP_LEAVES];
+	long cpus = stripes * BLAKE2SP_STRIPE_LEN >= BLAKE2SP_THREAD_MIN ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+#else
+	long cpus = 1;
+#endif
+	unsigned int nthreads, started = 1, i;
+
+	nthreads = cpus < 1 ? 1 : cpus > BLAKE2SP_LEAVES ? BLAKE2SP_LEAVES : (unsigned int)cpus;
+	for (i = 0; i < nthreads; ++i) {
+		jobs[i].hash = hash;
+		jobs[i].in = in;
+		jobs[i].stripes = stripes;
+		jobs[i].first = i;
+		jobs[i].step = nthreads;
+	}
+#ifndef SEEDRNG_NOLIBC
+	for (; started < nthreads; ++started) {
+		if (pthread_create(&threads[started], NULL, blake2sp_hash_leaves, &jobs[started]))
+			break;
+	}
+#endif
+	/* The calling thread takes the first share, and any not started. */
+	blake2sp_hash_leaves(&jobs[0]);
+	for (i = started; i < nthreads; ++i)
+		blake2sp_hash_leaves(&jobs[i]);
+#ifndef SEEDRNG_NOLIBC
+	for (i = 1; i < started; ++i)
+		pthread_join(threads[i], NULL);
+#endif
+}
+
+static void seed_hash_init(struct seed_hash *hash, enum hash_backend backend)
+{
+	unsigned int i;
+
+	memset(hash, 0, sizeof(*hash));
+	hash->backend = backend;
+	if (backend == HASH_BLAKE2S) {
+		blake2s_init(&hash->root, BLAKE2S_HASH_LEN);
+		return;
+	}
+	blake2sp_init_node(&hash->root, 0, 1);
+	for (i = 0; i < BLAKE2SP_LEAVES; ++i)
+		blake2sp_init_node(&hash->leaves[i], i, 0);
+}
+
+/*
+ * Like blake2s_update().  BLAKE2sp buffers up to a stripe of one block
+ * per leaf; each leaf holds back its own last block for finalization.
+ */
+static void seed_hash_update(struct seed_hash *hash, const void *inp, size_t inlen)
+{
+	const size_t fill = BLAKE2SP_STRIPE_LEN - hash->buflen;
+	const uint8_t *in = inp;
+	size_t stripes;
+
+	if (hash->backend == HASH_BLAKE2S) {
+		blake2s_update(&hash->root, in, inlen);
+		return;
+	}
+	if (hash->buflen && inlen >= fill) {
+		memcpy(hash->buf + hash->buflen, in, fill);
+		blake2sp_hash_stripes(hash, hash->buf, 1);
+		hash->buflen = 0;
+		in += fill;
+		inlen -= fill;
+	}
+	stripes = inlen / BLAKE2SP_STRIPE_LEN;
+	if (stripes) {
+		blake2sp_hash_stripes(hash, in, stripes);
+		in += stripes * BLAKE2SP_STRIPE_LEN;
+		inlen -= stripes * BLAKE2SP_STRIPE_LEN;
+	}
+	memcpy(hash->buf + hash->buflen, in, inlen);
+	hash->buflen += inlen;
+}
+
+static void seed_hash_final(struct seed_hash *hash, uint8_t *out)
+{
+	uint8_t leaf[BLAKE2S_HASH_LEN];
+	size_t i, left;
+
+	if (hash->backend == HASH_BLAKE2SP) {
+		for (i = 0; i < BLAKE2SP_LEAVES; ++i) {
+			if (hash->buflen > i * BLAKE2S_BLOCK_LEN) {
+				left = hash->buflen - i * BLAKE2S_BLOCK_LEN;
+				blake2s_update(&hash->leaves[i], hash->buf + i * BLAKE2S_BLOCK_LEN,
+					       left < BLAKE2S_BLOCK_LEN ? left : BLAKE2S_BLOCK_LEN);
+			}
+			/* The last leaf and the root are flagged as last nodes. */
+			if (i == BLAKE2SP_LEAVES - 1)
+				hash->leaves[i].f[1] = -1;
+			blake2s_final(&hash->leaves[i], leaf);
+			blake2s_update(&hash->root, leaf, sizeof(leaf));
+		}
+		memset(leaf, 0, sizeof(leaf));
+		hash->root.f[1] = -1;
+	}
+	blake2s_final(&hash->root, out);
+}
+
+/* Set by --dry-run: leave seeds and the RNG untouched. */
+static bool dry_run;
+
+enum log_level {
+	LOG_LEVEL_ERR     = 3,
+	LOG_LEVEL_WARNING = 4,
+	LOG_LEVEL_INFO    = 6
+};
+
+/*
+ * Where log messages go, chosen by SEEDRNG_LOG.  Unset keeps the plain
+ * stdout/stderr split; "kmsg", "stderr" or "fd:N" send every message
+ * to that one target, stamped with CLOCK_BOOTTIME so that it can be
+ * lined up with the kernel's own RNG messages.
+ */
+static struct {
+	bool initialized;
+	bool kmsg;
+	bool stamped;
+	int fd;
+} logger;
+
+static void log_init(void)
+{
+	const char *target = getenv("SEEDRNG_LOG");
+	char *end;
+	long fd;
+
+	logger.initialized = true;
+	logger.fd = -1;
+	if (!target || !*target)
+		return;
+	logger.stamped = true;
+	if (!strcmp(target, "kmsg")) {
+		logger.fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC | O_NOCTTY);
+		logger.kmsg = logger.fd >= 0;
+	} else if (!strncmp(target, "fd:", 3)) {
+		/* Only a number naming an open file descriptor will do. */
+		errno = 0;
+		fd = strtol(target + 3, &end, 10);
+		if (end != target + 3 && !*end && !errno && fd >= 0 && fd <= INT_MAX &&
+		    fcntl(fd, F_GETFD) >= 0)
+			logger.fd = fd;
+	}
+	if (logger.fd < 0)
+		logger.fd = STDERR_FILENO;
+}
+
+/* Formats the message into one buffer and emits it with one write(2). */
+static void log_vmsg(enum log_level level, const char *fmt, va_list ap)
+{
+	char buf[512];
+	struct timespec now;
+	size_t len = 0;
+	int saved_errno = errno, fd, ret;
+
+	if (!logger.initialized)
+		log_init();
+	fd = logger.fd >= 0 ? logger.fd : level <= LOG_LEVEL_WARNING ? STDERR_FILENO : STDOUT_FILENO;
+	if (logger.kmsg)
+		len = snprintf(buf, sizeof(buf), "<%d>seedrng[%d]: ", (1 << 3) | level, (int)getpid());
+	if (logger.stamped) {
+		clock_gettime(CLOCK_BOOTTIME, &now);
+		len += snprintf(buf + len, sizeof(buf) - len, "[%5ld.%06ld] ", (long)now.tv_sec, now.tv_nsec / 1000);
+	}
+	ret = vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+	if (ret > 0)
+		len += ret;
+	if (len > sizeof(buf) - 1)
+		len = sizeof(buf) - 1;
+	buf[len++] = '\n';
+	/* There is nowhere left to report a failure to log. */
+	ret = write(fd, buf, len);
+	errno = saved_errno;
+}
+
+__attribute__((format(printf, 2, 3)))
+static void log_msg(enum log_level level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	log_vmsg(level, fmt, ap);
+	va_end(ap);
+}
+
+/* Like perror(3), but through the logger. */
+static void log_perror(const char *msg)
+{
+	log_msg(LOG_LEVEL_ERR, "%s: %s", msg, strerror(errno));
+}
+
 static ssize_t getrandom_full(void *buf, size_t count, unsigned int flags)
 {
 	ssize_t ret, total = 0;
@@ -275,214 +728,4049 @@ static ssize_t write_full(int fd, const void *buf, size_t count)
 	return total;
 }
 
-static size_t determine_optimal_seed_len(void)
-{
-	size_t ret = 0;
-	char poolsize_str[11] = { 0 };
-	int fd = open("/proc/sys/kernel/random/poolsize", O_RDONLY);
+enum phase {
+	PHASE_LOCK,
+	PHASE_LOAD,
+	PHASE_SPOOL,
+	PHASE_SOURCES,
+	PHASE_JITTER,
+	PHASE_GENERATE,
+	PHASE_HASH,
+	PHASE_WRITE,
+	PHASE_SYNC,
+	PHASE_RENAME,
+	PHASE_FANOUT,
+	NR_PHASES
+};
 
-	if (fd < 0 || read_full(fd, poolsize_str, sizeof(poolsize_str) - 1) < 0) {
-		perror("Unable to determine pool size, falling back to 256 bits");
-		ret = MIN_SEED_LEN;
-	} else
-		ret = DIV_ROUND_UP(strtoul(poolsize_str, NULL, 10), 8);
-	if (fd >= 0)
-		close(fd);
-	if (ret < MIN_SEED_LEN)
-		ret = MIN_SEED_LEN;
-	else if (ret > MAX_SEED_LEN)
-		ret = MAX_SEED_LEN;
+static const char *const phase_names[NR_PHASES] = {
+	[PHASE_LOCK]     = "lock",
+	[PHASE_LOAD]     = "load",
+	[PHASE_SPOOL]    = "spool",
+	[PHASE_SOURCES]  = "sources",
+	[PHASE_JITTER]   = "jitter",
+	[PHASE_GENERATE] = "generate",
+	[PHASE_HASH]     = "hash",
+	[PHASE_WRITE]    = "write",
+	[PHASE_SYNC]     = "sync",
+	[PHASE_RENAME]   = "rename",
+	[PHASE_FANOUT]   = "fanout"
+};
 
-	return ret;
+/* What each phase cost besides time, see phase_usage_sample(). */
+enum resource {
+	RES_MINFLT,
+	RES_MAJFLT,
+	RES_NVCSW,
+	RES_NIVCSW,
+	RES_INBLOCK,
+	RES_OUBLOCK,
+	RES_RCHAR,
+	RES_WCHAR,
+	RES_SYSCR,
+	RES_SYSCW,
+	RES_TASK_CLOCK,
+	RES_CONTEXT_SWITCHES,
+	RES_PAGE_FAULTS,
+	NR_RESOURCES
+};
+
+enum resource_params {
+	FIRST_PERF_RESOURCE = RES_TASK_CLOCK,
+	NR_PERF_RESOURCES   = NR_RESOURCES - RES_TASK_CLOCK
+};
+
+static const char *const resource_names[NR_RESOURCES] = {
+	[RES_MINFLT]           = "minflt",
+	[RES_MAJFLT]           = "majflt",
+	[RES_NVCSW]            = "nvcsw",
+	[RES_NIVCSW]           = "nivcsw",
+	[RES_INBLOCK]          = "inblock",
+	[RES_OUBLOCK]          = "oublock",
+	[RES_RCHAR]            = "rchar",
+	[RES_WCHAR]            = "wchar",
+	[RES_SYSCR]            = "syscr",
+	[RES_SYSCW]            = "syscw",
+	[RES_TASK_CLOCK]       = "task-clock-ns",
+	[RES_CONTEXT_SWITCHES] = "context-switches",
+	[RES_PAGE_FAULTS]      = "page-faults"
+};
+
+static const uint64_t perf_configs[NR_PERF_RESOURCES] = {
+	[RES_TASK_CLOCK - FIRST_PERF_RESOURCE]       = PERF_COUNT_SW_TASK_CLOCK,
+	[RES_CONTEXT_SWITCHES - FIRST_PERF_RESOURCE] = PERF_COUNT_SW_CONTEXT_SWITCHES,
+	[RES_PAGE_FAULTS - FIRST_PERF_RESOURCE]      = PERF_COUNT_SW_PAGE_FAULTS
+};
+
+struct phase_usage {
+	int io_fd, perf_fds[NR_PERF_RESOURCES];
+	uint64_t last[NR_RESOURCES];
+	uint64_t delta[NR_PHASES][NR_RESOURCES];
+	uint64_t own_rchar, own_syscr;	/* the previous sample's own reads */
+};
+
+struct phase_timer {
+	struct timespec start, last;
+	uint64_t ns[NR_PHASES];
+	struct phase_usage *usage;	/* NULL unless resources are accounted */
+};
+
+static uint64_t timespec_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (uint64_t)(b->tv_sec - a->tv_sec) * 1000000000 + b->tv_nsec - a->tv_nsec;
 }
 
-static int read_new_seed(uint8_t *seed, size_t len, bool *is_creditable)
+/*
+ * Reads the counters of the whole process, threads included.  Counters
+ * whose source is unavailable stay zero.  The reads done here only show
+ * up in the next sample, which leaves them out.
+ */
+static void phase_usage_sample(struct phase_usage *usage, uint64_t v[NR_RESOURCES])
 {
-	ssize_t ret;
-	int urandom_fd;
+	static const char *const io_keys[] = { "rchar:", "wchar:", "syscr:", "syscw:" };
+	struct rusage ru;
+	char buf[512], *line, *saveptr = NULL;
+	ssize_t len;
+	size_t i;
 
-	*is_creditable = false;
-	ret = getrandom_full(seed, len, GRND_NONBLOCK);
-	if (ret == (ssize_t)len) {
-		*is_creditable = true;
-		return 0;
-	} else if (ret < 0 && errno == ENOSYS) {
-		struct pollfd random_fd = {
-			.fd = open("/dev/random", O_RDONLY),
-			.events = POLLIN
-		};
-		if (random_fd.fd < 0)
-			return -errno;
-		*is_creditable = poll(&random_fd, 1, 0) == 1;
-		close(random_fd.fd);
-	} else if (getrandom_full(seed, len, GRND_INSECURE) == (ssize_t)len)
-		return 0;
-	urandom_fd = open("/dev/urandom", O_RDONLY);
-	if (urandom_fd < 0)
-		return -1;
-	ret = read_full(urandom_fd, seed, len);
-	if (ret == (ssize_t)len)
-		ret = 0;
-	else
-		ret = -errno ? -errno : -EIO;
-	close(urandom_fd);
-	errno = -ret;
-	return ret ? -1 : 0;
+	memset(v, 0, NR_RESOURCES * sizeof(*v));
+	usage->own_rchar = usage->own_syscr = 0;
+	if (!getrusage(RUSAGE_SELF, &ru)) {
+		v[RES_MINFLT] = ru.ru_minflt;
+		v[RES_MAJFLT] = ru.ru_majflt;
+		v[RES_NVCSW] = ru.ru_nvcsw;
+		v[RES_NIVCSW] = ru.ru_nivcsw;
+		v[RES_INBLOCK] = ru.ru_inblock;
+		v[RES_OUBLOCK] = ru.ru_oublock;
+	}
+	if (usage->io_fd >= 0 && (len = pread(usage->io_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		usage->own_rchar = len;
+		usage->own_syscr = 1;
+		buf[len] = '\0';
+		for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+			for (i = 0; i < ARRAY_SIZE(io_keys); ++i) {
+				if (!strncmp(line, io_keys[i], strlen(io_keys[i])))
+					v[RES_RCHAR + i] = strtoul(line + strlen(io_keys[i]), NULL, 10);
+			}
+		}
+	}
+	for (i = 0; i < NR_PERF_RESOURCES; ++i) {
+		if (usage->perf_fds[i] < 0)
+			continue;
+		if (read_full(usage->perf_fds[i], &v[FIRST_PERF_RESOURCE + i], sizeof(*v)) != sizeof(*v))
+			v[FIRST_PERF_RESOURCE + i] = 0;
+		if (usage->own_syscr) {
+			usage->own_rchar += sizeof(*v);
+			++usage->own_syscr;
+		}
+	}
 }
 
-static int seed_rng(uint8_t *seed, size_t len, bool credit)
+static int perf_counter_open(uint64_t config)
 {
-	struct {
-		int entropy_count;
-		int buf_size;
-		uint8_t buffer[MAX_SEED_LEN];
-	} req = {
-		.entropy_count = credit ? len * 8 : 0,
-		.buf_size = len
+	struct perf_event_attr attr = {
+		.type = PERF_TYPE_SOFTWARE,
+		.size = sizeof(attr),
+		.config = config,
+		.inherit = 1
 	};
-	int random_fd, ret;
+	int fd;
 
-	if (len > sizeof(req.buffer)) {
-		errno = EFBIG;
-		return -1;
+	fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	/* With perf_event_paranoid at 2 or above, only user space is counted. */
+	if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = attr.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
 	}
-	memcpy(req.buffer, seed, len);
+	return fd;
+}
 
-	random_fd = open("/dev/urandom", O_RDONLY);
-	if (random_fd < 0)
-		return -1;
-	ret = ioctl(random_fd, RNDADDENTROPY, &req);
-	if (ret)
-		ret = -errno ? -errno : -EIO;
-	close(random_fd);
-	errno = -ret;
-	return ret ? -1 : 0;
+static void phase_usage_start(struct phase_usage *usage)
+{
+	size_t i;
+
+	memset(usage, 0, sizeof(*usage));
+	usage->io_fd = open("/proc/self/io", O_RDONLY | O_CLOEXEC);
+	for (i = 0; i < NR_PERF_RESOURCES; ++i)
+		usage->perf_fds[i] = perf_counter_open(perf_configs[i]);
+	phase_usage_sample(usage, usage->last);
 }
 
-static int seed_from_file_if_exists(const char *filename, int dfd, bool credit, struct blake2s_state *hash)
+static void phase_usage_stop(struct phase_usage *usage)
 {
-	uint8_t seed[MAX_SEED_LEN];
-	ssize_t seed_len;
-	int fd = -1, ret = 0;
+	size_t i;
 
-	fd = openat(dfd, filename, O_RDONLY);
-	if (fd < 0 && errno == ENOENT)
-		return 0;
-	else if (fd < 0) {
-		ret = -errno;
-		perror("Unable to open seed file");
-		goto out;
-	}
-	seed_len = read_full(fd, seed, sizeof(seed));
-	if (seed_len < 0) {
-		ret = -errno;
-		perror("Unable to read seed file");
-		goto out;
+	if (usage->io_fd >= 0)
+		close(usage->io_fd);
+	for (i = 0; i < NR_PERF_RESOURCES; ++i) {
+		if (usage->perf_fds[i] >= 0)
+			close(usage->perf_fds[i]);
 	}
-	if ((unlinkat(dfd, filename, 0) < 0 || fsync(dfd) < 0) && seed_len) {
-		ret = -errno;
-		perror("Unable to remove seed after reading, so not seeding");
-		goto out;
+}
+
+/* With usage, the resources used by each phase are accounted as well. */
+static void phase_start(struct phase_timer *timer, struct phase_usage *usage)
+{
+	memset(timer, 0, sizeof(*timer));
+	if (usage) {
+		phase_usage_start(usage);
+		timer->usage = usage;
 	}
-	if (!seed_len)
-		goto out;
+	clock_gettime(CLOCK_MONOTONIC, &timer->start);
+	timer->last = timer->start;
+}
 
-	blake2s_update(hash, &seed_len, sizeof(seed_len));
-	blake2s_update(hash, seed, seed_len);
+/* Charges the time since the previous phase ended to phase. */
+static void phase_end(struct phase_timer *timer, enum phase phase)
+{
+	struct phase_usage *usage = timer->usage;
+	struct timespec now;
+	uint64_t v[NR_RESOURCES], own_rchar, own_syscr;
+	int i;
 
-	printf("Seeding %zd bits %s crediting\n", seed_len * 8, credit ? "and" : "without");
-	if (seed_rng(seed, seed_len, credit) < 0) {
-		ret = -errno;
-		perror("Unable to seed");
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timer->ns[phase] += timespec_diff_ns(&timer->last, &now);
+	timer->last = now;
+	if (!usage)
+		return;
+	own_rchar = usage->own_rchar;
+	own_syscr = usage->own_syscr;
+	phase_usage_sample(usage, v);
+	if (v[RES_RCHAR]) {
+		usage->last[RES_RCHAR] += own_rchar;
+		usage->last[RES_SYSCR] += own_syscr;
+	}
+	for (i = 0; i < NR_RESOURCES; ++i) {
+		usage->delta[phase][i] += v[i] - usage->last[i];
+		usage->last[i] = v[i];
 	}
-
-out:
-	if (fd >= 0)
-		close(fd);
-	errno = -ret;
-	return ret ? -1 : 0;
 }
 
-static bool skip_credit(void)
+static void print_phase_timings(const struct phase_timer *timer)
 {
-	const char *skip = getenv("SEEDRNG_SKIP_CREDIT");
-	return skip && (!strcmp(skip, "1") || !strcasecmp(skip, "true") ||
-			!strcasecmp(skip, "yes") || !strcasecmp(skip, "y"));
+	int i;
+
+	printf("Phase timings%s:\n", dry_run ? " (dry run)" : "");
+	for (i = 0; i < NR_PHASES; ++i)
+		printf("  %-10s %10.3f ms\n", phase_names[i], timer->ns[i] / 1e6);
+	printf("  %-10s %10.3f ms\n", "total", timespec_diff_ns(&timer->start, &timer->last) / 1e6);
 }
 
-int main(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+/* Only the counters a phase moved are printed. */
+static void print_phase_usage(const struct phase_usage *usage, size_t seeded, size_t new_seed_len,
+			      bool creditable)
 {
-	static const char seedrng_prefix[] = "SeedRNG v1 Old+New Prefix";
-	static const char seedrng_failure[] = "SeedRNG v1 No New Seed Failure";
-	int fd = -1, dfd = -1, program_ret = 0;
-	uint8_t new_seed[MAX_SEED_LEN];
-	size_t new_seed_len;
-	bool new_seed_creditable;
-	struct timespec realtime = { 0 }, boottime = { 0 };
+	uint64_t v, total[NR_RESOURCES] = { 0 };
+	int p, r;
+
+	printf("Phase resources (%zu bytes seeded, new seed of %zu bits, %s%s):\n", seeded,
+	       new_seed_len * 8, creditable ? "creditable" : "non-creditable",
+	       usage->perf_fds[0] < 0 ? ", no perf counters" : "");
+	for (p = 0; p <= NR_PHASES; ++p) {
+		printf("  %-10s", p < NR_PHASES ? phase_names[p] : "total");
+		for (r = 0; r < NR_RESOURCES; ++r) {
+			v = p < NR_PHASES ? usage->delta[p][r] : total[r];
+			if (p < NR_PHASES)
+				total[r] += v;
+			if (v)
+				printf(" %s=%llu", resource_names[r], (unsigned long long)v);
+		}
+		printf("\n");
+	}
+}
+
+enum sync_method {
+	SYNC_FSYNC,
+	SYNC_FDATASYNC,
+	SYNC_SYNCFS,
+	NR_SYNC_METHODS
+};
+
+static const char *const sync_method_names[NR_SYNC_METHODS] = {
+	[SYNC_FSYNC]     = "fsync",
+	[SYNC_FDATASYNC] = "fdatasync",
+	[SYNC_SYNCFS]    = "syncfs"
+};
+
+enum fanout_params {
+	MAX_FANOUT_TARGETS = 16
+};
+
+/* Which phases run at background priority, see set_background(). */
+enum priority_policy {
+	PRIORITY_NONE,
+	PRIORITY_BOOT,
+	PRIORITY_SHUTDOWN,
+	NR_PRIORITY_POLICIES
+};
+
+static const char *const priority_policy_names[NR_PRIORITY_POLICIES] = {
+	[PRIORITY_NONE]     = "none",
+	[PRIORITY_BOOT]     = "boot",
+	[PRIORITY_SHUTDOWN] = "shutdown"
+};
+
+/* What waits for a read-only seed directory, see commit_pending(). */
+enum defer_mode {
+	DEFER_WATCH,
+	DEFER_COMMIT,
+	NR_DEFER_MODES
+};
+
+static const char *const defer_mode_names[NR_DEFER_MODES] = {
+	[DEFER_WATCH]  = "watch",
+	[DEFER_COMMIT] = "commit"
+};
+
+enum background_level {
+	BACKGROUND_IDLE,
+	BACKGROUND_LOW,
+	NR_BACKGROUND_LEVELS
+};
+
+static const char *const background_level_names[NR_BACKGROUND_LEVELS] = {
+	[BACKGROUND_IDLE] = "idle",
+	[BACKGROUND_LOW]  = "low"
+};
+
+/* A userspace seed file derived from the chain on every run. */
+struct fanout_target {
+	char *path;
+	size_t len;
+};
+
+/* Settings from CONFIG_FILE in the seed directory. */
+struct config {
+	enum sync_method sync;
+	enum priority_policy priority;
+	enum background_level background_io, background_cpu;
+	enum defer_mode defer;
+	enum hash_backend hash;
+	struct fanout_target fanout[MAX_FANOUT_TARGETS];
+	size_t nr_fanout;
+};
+
+static const struct config default_config = {
+	.sync = SYNC_FSYNC,
+	.priority = PRIORITY_NONE,
+	.background_io = BACKGROUND_IDLE,
+	.background_cpu = BACKGROUND_IDLE,
+	.defer = DEFER_WATCH,
+	.hash = HASH_BLAKE2S
+};
+
+static struct config config;
+
+/*
+ * Makes the contents of a newly written seed durable.  All methods flush
+ * the file data and size before returning, which is all that crediting
+ * the seed on the next boot relies on.  syncfs only reports a failure to
+ * write back the file since Linux 5.8, so it is refused before that.
+ */
+static int sync_file(int fd)
+{
+	switch (config.sync) {
+	case SYNC_FDATASYNC:
+		return fdatasync(fd);
+	case SYNC_SYNCFS:
+		return syscall(SYS_syncfs, fd);
+	default:
+		return fsync(fd);
+	}
+}
+
+static bool kernel_at_least(unsigned long major, unsigned long minor)
+{
+	struct utsname uts;
+	unsigned long version;
+	char *end;
+
+	if (uname(&uts) < 0)
+		return false;
+	version = strtoul(uts.release, &end, 10);
+	if (version != major)
+		return version > major;
+	return *end == '.' && strtoul(end + 1, NULL, 10) >= minor;
+}
+
+static char *trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		++str;
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return str;
+}
+
+/* Parses "path [length]" into the next fan-out target. */
+static int parse_fanout(char *value)
+{
+	struct fanout_target *target = &config.fanout[config.nr_fanout];
+	char *len = value + strcspn(value, " \t"), *end;
+
+	if (config.nr_fanout == MAX_FANOUT_TARGETS || *value != '/')
+		return -1;
+	target->len = MAX_SEED_LEN;
+	if (*len) {
+		*len++ = '\0';
+		target->len = strtoul(len, &end, 10);
+		if (*trim(end) || !target->len || target->len > MAX_SEED_LEN)
+			return -1;
+	}
+	target->path = strdup(value);
+	if (!target->path)
+		return -1;
+	++config.nr_fanout;
+	return 0;
+}
+
+/* Stores the index of value in names into *out. */
+static int parse_name(const char *value, const char *const *names, int count, unsigned int *out)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		if (!strcmp(value, names[i])) {
+			*out = i;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+static int parse_config_line(char *line)
+{
+	char *key, *value = strchr(line, '=');
+	unsigned int i;
+
+	if (!value)
+		return -1;
+	*value++ = '\0';
+	key = trim(line);
+	value = trim(value);
+	if (!strcmp(key, "sync")) {
+		if (parse_name(value, sync_method_names, NR_SYNC_METHODS, &i) < 0 ||
+		    (i == SYNC_SYNCFS && !kernel_at_least(5, 8)))
+			return -1;
+		config.sync = i;
+	} else if (!strcmp(key, "priority")) {
+		if (parse_name(value, priority_policy_names, NR_PRIORITY_POLICIES, &i) < 0)
+			return -1;
+		config.priority = i;
+	} else if (!strcmp(key, "background_io")) {
+		if (parse_name(value, background_level_names, NR_BACKGROUND_LEVELS, &i) < 0)
+			return -1;
+		config.background_io = i;
+	} else if (!strcmp(key, "background_cpu")) {
+		if (parse_name(value, background_level_names, NR_BACKGROUND_LEVELS, &i) < 0)
+			return -1;
+		config.background_cpu = i;
+	} else if (!strcmp(key, "defer")) {
+		if (parse_name(value, defer_mode_names, NR_DEFER_MODES, &i) < 0)
+			return -1;
+		config.defer = i;
+	} else if (!strcmp(key, "hash")) {
+		if (parse_name(value, hash_backend_names, NR_HASH_BACKENDS, &i) < 0)
+			return -1;
+		config.hash = i;
+	} else if (!strcmp(key, "fanout"))
+		return parse_fanout(value);
+	else
+		return -1;
+	return 0;
+}
+
+/* Reads "key = value" lines, ignoring blank lines and # comments. */
+static int read_config(int dfd)
+{
+	char buf[4096], *line, *saveptr = NULL;
+	ssize_t len;
+	size_t i;
+	int fd, ret = 0;
+
+	/* Start over, as `seedrng watch' reads it again on every run. */
+	for (i = 0; i < config.nr_fanout; ++i)
+		free(config.fanout[i].path);
+	config = default_config;
+
+	fd = openat(dfd, CONFIG_FILE, O_RDONLY);
+	if (fd < 0 && errno == ENOENT)
+		return 0;
+	else if (fd < 0) {
+		log_perror("Unable to open configuration file");
+		return -1;
+	}
+	len = read_full(fd, buf, sizeof(buf) - 1);
+	if (len < 0) {
+		ret = -errno;
+		log_perror("Unable to read configuration file");
+		goto out;
+	}
+	buf[len] = '\0';
+	for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		line[strcspn(line, "#")] = '\0';
+		if (!*trim(line))
+			continue;
+		if (parse_config_line(line) < 0) {
+			ret = -EINVAL;
+			log_msg(LOG_LEVEL_WARNING, "Ignoring invalid configuration line: %s", line);
+		}
+	}
+
+out:
+	close(fd);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+#ifndef SCHED_IDLE
+# define SCHED_IDLE 5
+#endif
+
+/* From linux/ioprio.h, which older kernel headers lack. */
+#ifndef IOPRIO_CLASS_SHIFT
+# define IOPRIO_CLASS_SHIFT 13
+# define IOPRIO_CLASS_BE    2
+# define IOPRIO_CLASS_IDLE  3
+# define IOPRIO_WHO_PROCESS 1
+#endif
+
+enum background_params {
+	BACKGROUND_BE_LEVEL = 7,
+	BACKGROUND_NICE     = 19
+};
+
+/* Scheduling state saved while running at background priority. */
+static struct {
+	bool active;
+	int ioprio;
+	int policy;
+	int nice;
+	struct sched_param param;
+} background;
+
+/*
+ * Moves the process to the configured background I/O class and CPU
+ * policy, or back to what it had before.  Priorities are a courtesy to
+ * the rest of the system, so failures only warn.  "idle" maps to
+ * IOPRIO_CLASS_IDLE and SCHED_IDLE, "low" to the lowest best-effort I/O
+ * level and nice 19.
+ */
+static void set_background(bool on)
+{
+	struct sched_param idle = { .sched_priority = 0 };
+	int ioprio;
+
+	if (on == background.active)
+		return;
+	if (on) {
+		background.ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+		background.policy = sched_getscheduler(0);
+		sched_getparam(0, &background.param);
+		errno = 0;
+		background.nice = getpriority(PRIO_PROCESS, 0);
+		if (background.nice == -1 && errno)
+			background.nice = 0;
+
+		if (config.background_io == BACKGROUND_IDLE)
+			ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+		else
+			ioprio = IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | BACKGROUND_BE_LEVEL;
+		if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) < 0)
+			log_perror("Unable to lower I/O priority");
+		if (config.background_cpu == BACKGROUND_IDLE && sched_setscheduler(0, SCHED_IDLE, &idle) < 0)
+			log_perror("Unable to lower CPU priority");
+		else if (config.background_cpu == BACKGROUND_LOW && setpriority(PRIO_PROCESS, 0, BACKGROUND_NICE) < 0)
+			log_perror("Unable to lower CPU priority");
+	} else {
+		if (background.ioprio >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, background.ioprio) < 0)
+			log_perror("Unable to restore I/O priority");
+		if (background.policy >= 0 && sched_setscheduler(0, background.policy, &background.param) < 0)
+			log_perror("Unable to restore CPU priority");
+		if (setpriority(PRIO_PROCESS, 0, background.nice) < 0)
+			log_perror("Unable to restore CPU priority");
+	}
+	background.active = on;
+}
+
+static size_t determine_optimal_seed_len(void)
+{
+	size_t ret = 0;
+	char poolsize_str[11] = { 0 };
+	int fd;
+
+	TRACE0(determine_optimal_seed_len__entry);
+	fd = open("/proc/sys/kernel/random/poolsize", O_RDONLY);
+	if (fd < 0 || read_full(fd, poolsize_str, sizeof(poolsize_str) - 1) < 0) {
+		log_perror("Unable to determine pool size, falling back to 256 bits");
+		ret = MIN_SEED_LEN;
+	} else
+		ret = DIV_ROUND_UP(strtoul(poolsize_str, NULL, 10), 8);
+	if (fd >= 0)
+		close(fd);
+	if (ret < MIN_SEED_LEN)
+		ret = MIN_SEED_LEN;
+	else if (ret > MAX_SEED_LEN)
+		ret = MAX_SEED_LEN;
+
+	TRACE1(determine_optimal_seed_len__return, ret);
+	return ret;
+}
+
+static int read_new_seed(uint8_t *seed, size_t len, bool *is_creditable)
+{
+	ssize_t ret;
+	int urandom_fd;
+
+	TRACE1(read_new_seed__entry, len);
+	*is_creditable = false;
+	ret = getrandom_full(seed, len, GRND_NONBLOCK);
+	if (ret == (ssize_t)len) {
+		*is_creditable = true;
+		TRACE3(read_new_seed__return, 0, *is_creditable, 0);
+		return 0;
+	} else if (ret < 0 && errno == ENOSYS) {
+		struct pollfd random_fd = {
+			.fd = open("/dev/random", O_RDONLY),
+			.events = POLLIN
+		};
+		if (random_fd.fd < 0) {
+			TRACE3(read_new_seed__return, -1, *is_creditable, errno);
+			return -errno;
+		}
+		*is_creditable = poll(&random_fd, 1, 0) == 1;
+		close(random_fd.fd);
+	} else if (getrandom_full(seed, len, GRND_INSECURE) == (ssize_t)len) {
+		TRACE3(read_new_seed__return, 0, *is_creditable, 0);
+		return 0;
+	}
+	urandom_fd = open("/dev/urandom", O_RDONLY);
+	if (urandom_fd < 0) {
+		TRACE3(read_new_seed__return, -1, *is_creditable, errno);
+		return -1;
+	}
+	ret = read_full(urandom_fd, seed, len);
+	if (ret == (ssize_t)len)
+		ret = 0;
+	else
+		ret = -errno ? -errno : -EIO;
+	close(urandom_fd);
+	errno = -ret;
+	TRACE3(read_new_seed__return, ret ? -1 : 0, *is_creditable, errno);
+	return ret ? -1 : 0;
+}
+
+static int seed_rng(uint8_t *seed, size_t len, bool credit)
+{
+	struct {
+		int entropy_count;
+		int buf_size;
+		uint8_t buffer[MAX_SEED_LEN];
+	} req = {
+		.entropy_count = credit ? len * 8 : 0,
+		.buf_size = len
+	};
+	int random_fd, ret;
+
+	TRACE2(seed_rng__entry, len, credit);
+	if (len > sizeof(req.buffer)) {
+		ret = -EFBIG;
+		goto out;
+	}
+	memcpy(req.buffer, seed, len);
+
+	random_fd = open("/dev/urandom", O_RDONLY);
+	if (random_fd < 0) {
+		ret = -errno;
+		goto out;
+	}
+	ret = dry_run ? 0 : ioctl(random_fd, RNDADDENTROPY, &req);
+	if (ret)
+		ret = -errno ? -errno : -EIO;
+	close(random_fd);
+out:
+	errno = -ret;
+	TRACE3(seed_rng__return, len, credit, -ret);
+	return ret ? -1 : 0;
+}
+
+/* Identifies a seed file that was read but could not be removed. */
+struct tombstone {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+};
+
+/*
+ * When tomb is given, the seed directory is read-only: the file is left
+ * in place and recorded in *tomb, to be removed once it can be.
+ */
+static int seed_from_file_if_exists(const char *filename, int dfd, bool credit, struct seed_hash *hash, size_t *seeded,
+				    struct tombstone *tomb)
+{
+	struct stat st;
+	uint8_t seed[MAX_SEED_LEN];
+	ssize_t seed_len;
+	size_t total = 0;
+	int fd = -1, ret = 0;
+
+	TRACE2(seed_from_file__entry, filename, credit);
+	fd = openat(dfd, filename, O_RDONLY);
+	if (fd < 0 && errno == ENOENT) {
+		TRACE3(seed_from_file__return, filename, 0, 0);
+		return 0;
+	}
+	else if (fd < 0) {
+		ret = -errno;
+		log_perror("Unable to open seed file");
+		goto out;
+	}
+	seed_len = read_full(fd, seed, sizeof(seed));
+	if (seed_len < 0) {
+		ret = -errno;
+		log_perror("Unable to read seed file");
+		goto out;
+	}
+	if (tomb) {
+		if (fstat(fd, &st) < 0) {
+			ret = -errno;
+			log_perror("Unable to read seed file");
+			goto out;
+		}
+		tomb->dev = st.st_dev;
+		tomb->ino = st.st_ino;
+		tomb->size = st.st_size;
+	} else if (((!dry_run && unlinkat(dfd, filename, 0) < 0) || fsync(dfd) < 0) && seed_len) {
+		ret = -errno;
+		log_perror("Unable to remove seed after reading, so not seeding");
+		goto out;
+	}
+
+	/*
+	 * Seeds larger than MAX_SEED_LEN are streamed through a single
+	 * buffer: each chunk is hashed and submitted on its own, so memory
+	 * use does not depend on the file size.  The file is already
+	 * unlinked or tombstoned at this point, and we keep reading from
+	 * the open fd.
+	 */
+	while (seed_len > 0) {
+		seed_hash_update(hash, &seed_len, sizeof(seed_len));
+		seed_hash_update(hash, seed, seed_len);
+
+		log_msg(LOG_LEVEL_INFO, "Seeding %zd bits %s crediting", seed_len * 8, credit ? "and" : "without");
+		if (seed_rng(seed, seed_len, credit) < 0) {
+			ret = -errno;
+			log_perror("Unable to seed");
+			goto out;
+		}
+		*seeded += seed_len;
+		total += seed_len;
+		if (seed_len < (ssize_t)sizeof(seed))
+			break;
+		seed_len = read_full(fd, seed, sizeof(seed));
+		if (seed_len < 0) {
+			ret = -errno;
+			log_perror("Unable to read seed file");
+			goto out;
+		}
+	}
+
+out:
+	if (fd >= 0)
+		close(fd);
+	errno = -ret;
+	TRACE3(seed_from_file__return, filename, total, -ret);
+	return ret ? -1 : 0;
+}
+
+struct seed_batch {
+	uint8_t buf[MAX_SEED_LEN];
+	size_t len;
+	bool credit;
+};
+
+static int flush_seed_batch(struct seed_batch *batch, int spool_dfd, bool *synced, size_t *seeded)
+{
+	if (!batch->len)
+		return 0;
+	/* Fragments were unlinked when opened; make that durable first. */
+	if (!*synced) {
+		if (fsync(spool_dfd) < 0) {
+			log_perror("Unable to remove spooled seeds after reading, so not seeding");
+			return -1;
+		}
+		*synced = true;
+	}
+	log_msg(LOG_LEVEL_INFO, "Seeding %zu bits of spooled seeds %s crediting", batch->len * 8, batch->credit ? "and" : "without");
+	if (seed_rng(batch->buf, batch->len, batch->credit) < 0) {
+		log_perror("Unable to seed");
+		return -1;
+	}
+	*seeded += batch->len;
+	batch->len = 0;
+	return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static bool is_creditable_fragment(const char *name)
+{
+	size_t len = strlen(name), suffix_len = strlen(SPOOL_CREDIT_SUFFIX);
+
+	return len > suffix_len && !strcmp(name + len - suffix_len, SPOOL_CREDIT_SUFFIX);
+}
+
+static int seed_from_spool_if_exists(int dfd, bool credit, struct seed_hash *hash, size_t *seeded)
+{
+	struct seed_batch batches[2] = { { .credit = false }, { .credit = credit } };
+	char **names = NULL, **new_names;
+	size_t count = 0, alloc = 0, i;
+	bool synced = true;
+	struct dirent *ent;
+	DIR *dir;
+	int spool_dfd, ret = 0;
+
+	spool_dfd = openat(dfd, SPOOL_DIR, O_DIRECTORY | O_RDONLY);
+	if (spool_dfd < 0 && errno == ENOENT)
+		return 0;
+	if (spool_dfd < 0 || !(dir = fdopendir(spool_dfd))) {
+		ret = -errno;
+		log_perror("Unable to open spool directory");
+		if (spool_dfd >= 0)
+			close(spool_dfd);
+		errno = -ret;
+		return -1;
+	}
+
+	/* Dot files are fragments still being written by their producer. */
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 16;
+			new_names = realloc(names, alloc * sizeof(*names));
+			if (!new_names) {
+				ret = -errno;
+				log_perror("Unable to list spool directory");
+				goto out;
+			}
+			names = new_names;
+		}
+		if (!(names[count] = strdup(ent->d_name))) {
+			ret = -errno;
+			log_perror("Unable to list spool directory");
+			goto out;
+		}
+		++count;
+	}
+	if (count)
+		qsort(names, count, sizeof(*names), compare_names);
+
+	for (i = 0; i < count; ++i) {
+		struct seed_batch *batch = &batches[is_creditable_fragment(names[i])];
+		struct stat st;
+		ssize_t len;
+		int fd;
+
+		fd = openat(spool_dfd, names[i], O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+		if (fd < 0) {
+			ret = -errno;
+			log_perror("Unable to open spooled seed");
+			continue;
+		}
+		if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+			close(fd);
+			continue;
+		}
+		if (!dry_run && unlinkat(spool_dfd, names[i], 0) < 0) {
+			ret = -errno;
+			log_perror("Unable to remove spooled seed, so not seeding");
+			close(fd);
+			continue;
+		}
+		synced = false;
+
+		for (;;) {
+			len = read_full(fd, batch->buf + batch->len, sizeof(batch->buf) - batch->len);
+			if (len < 0) {
+				ret = -errno;
+				log_perror("Unable to read spooled seed");
+				break;
+			}
+			if (!len)
+				break;
+			seed_hash_update(hash, &len, sizeof(len));
+			seed_hash_update(hash, batch->buf + batch->len, len);
+			batch->len += len;
+			if (batch->len == sizeof(batch->buf) && flush_seed_batch(batch, spool_dfd, &synced, seeded) < 0) {
+				ret = -errno;
+				batch->len = 0;
+			}
+		}
+		close(fd);
+	}
+	for (i = 0; i < ARRAY_SIZE(batches); ++i) {
+		if (flush_seed_batch(&batches[i], spool_dfd, &synced, seeded) < 0)
+			ret = -errno;
+	}
+
+out:
+	while (count)
+		free(names[--count]);
+	free(names);
+	closedir(dir);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+enum host_data_params {
+	HOST_FILE_MAX = 64 * 1024,	/* bounds /proc/interrupts on large machines */
+	HOST_MAX_NET  = 64
+};
+
+enum host_dir {
+	HOST_ETC,
+	HOST_PROC,
+	HOST_SYS_CLASS,
+	NR_HOST_DIRS
+};
+
+static const char *const host_dir_paths[NR_HOST_DIRS] = {
+	[HOST_ETC]       = "/etc",
+	[HOST_PROC]      = "/proc",
+	[HOST_SYS_CLASS] = "/sys/class"
+};
+
+static const struct host_file {
+	enum host_dir dir;
+	const char *path;
+} host_files[] = {
+	{ HOST_ETC,       "machine-id" },
+	{ HOST_PROC,      "sys/kernel/random/boot_id" },
+	{ HOST_PROC,      "interrupts" },
+	{ HOST_PROC,      "stat" },
+	{ HOST_SYS_CLASS, "dmi/id/product_uuid" },
+	{ HOST_SYS_CLASS, "dmi/id/product_serial" },
+	{ HOST_SYS_CLASS, "dmi/id/board_serial" },
+	{ HOST_SYS_CLASS, "dmi/id/chassis_serial" }
+};
+
+static uint64_t cycle_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	uint32_t lo, hi;
+
+	__asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return (uint64_t)hi << 32 | lo;
+#elif defined(__aarch64__)
+	uint64_t val;
+
+	__asm__ volatile("mrs %0, cntvct_el0" : "=r"(val));
+	return val;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* Hashes up to HOST_FILE_MAX bytes of path below dfd, returning the count. */
+static size_t hash_host_file(int dfd, const char *path, struct seed_hash *hash)
+{
+	uint8_t buf[4096];
+	size_t total = 0;
+	ssize_t len;
+	int fd;
+
+	fd = openat(dfd, path, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+	if (fd < 0)
+		return 0;
+	while (total < HOST_FILE_MAX && (len = pread(fd, buf, sizeof(buf), total)) > 0) {
+		seed_hash_update(hash, &len, sizeof(len));
+		seed_hash_update(hash, buf, len);
+		total += len;
+	}
+	close(fd);
+	return total;
+}
+
+/*
+ * Hashes cheap data that tells hosts, and boots of clones of one image,
+ * apart: the random bytes the kernel gave this process, the cycle
+ * counter, the machine and boot IDs, DMI serials, MAC addresses and
+ * interrupt and CPU counters.  Clones share their seed file, so this
+ * runs on every boot, but none of it is secret, so it is only hashed,
+ * never credited or counted as seeded.  Files are opened relative to
+ * directories opened once, and read without seeking or statting.
+ */
+static void seed_from_host_data(struct seed_hash *hash)
+{
+	int dfds[NR_HOST_DIRS], net_dfd;
+	const uint8_t *at_random;
+	char path[NAME_MAX + sizeof("/address")];
+	uint64_t cycles = cycle_counter();
+	size_t i, bytes = 0, nets = 0;
+	struct dirent *ent;
+	DIR *dir;
+
+	seed_hash_update(hash, &cycles, sizeof(cycles));
+	at_random = (const uint8_t *)getauxval(AT_RANDOM);
+	if (at_random) {
+		seed_hash_update(hash, at_random, 16);
+		bytes += 16;
+	}
+	for (i = 0; i < NR_HOST_DIRS; ++i)
+		dfds[i] = open(host_dir_paths[i], O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	for (i = 0; i < ARRAY_SIZE(host_files); ++i) {
+		if (dfds[host_files[i].dir] >= 0)
+			bytes += hash_host_file(dfds[host_files[i].dir], host_files[i].path, hash);
+	}
+
+	net_dfd = dfds[HOST_SYS_CLASS] < 0 ? -1 : openat(dfds[HOST_SYS_CLASS], "net", O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	dir = net_dfd < 0 ? NULL : fdopendir(net_dfd);
+	if (!dir && net_dfd >= 0)
+		close(net_dfd);
+	while (dir && nets < HOST_MAX_NET && (ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/address", ent->d_name);
+		bytes += hash_host_file(net_dfd, path, hash);
+		++nets;
+	}
+	if (dir)
+		closedir(dir);
+	for (i = 0; i < NR_HOST_DIRS; ++i) {
+		if (dfds[i] >= 0)
+			close(dfds[i]);
+	}
+
+	cycles = cycle_counter();
+	seed_hash_update(hash, &cycles, sizeof(cycles));
+	log_msg(LOG_LEVEL_INFO, "Hashing %zu bytes of host data without crediting", bytes);
+}
+
+enum aux_source_params {
+	MAX_AUX_SOURCES        = 16,
+	AUX_DEFAULT_TIMEOUT_MS = 50
+};
+
+struct aux_source {
+	const char *path;
+	uint8_t buf[MAX_SEED_LEN];
+	size_t len;
+};
+
+static int aux_timeout_ms(void)
+{
+	const char *timeout = getenv("SEEDRNG_EXTRA_TIMEOUT_MS");
+	unsigned long ms;
+
+	if (!timeout)
+		return AUX_DEFAULT_TIMEOUT_MS;
+	ms = strtoul(timeout, NULL, 10);
+	return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+/*
+ * Reads up to MAX_SEED_LEN bytes from each of the colon separated paths
+ * in SEEDRNG_EXTRA_SOURCES.  All sources are read concurrently with
+ * non-blocking I/O until they are full, hit EOF, or the shared deadline
+ * passes, so a slow device never holds up the others.  Whatever arrived
+ * in time is hashed and written into the pool without crediting.
+ */
+static int seed_from_aux_sources(struct seed_hash *hash, size_t *seeded)
+{
+	const char *env = getenv("SEEDRNG_EXTRA_SOURCES");
+	struct aux_source *sources;
+	struct pollfd fds[MAX_AUX_SOURCES];
+	struct timespec now, deadline;
+	char *paths, *path, *saveptr = NULL;
+	size_t count = 0, pending, i;
+	int timeout, ret = 0;
+	int64_t left;
+	ssize_t len;
+
+	if (!env || !*env)
+		return 0;
+	paths = strdup(env);
+	sources = calloc(MAX_AUX_SOURCES, sizeof(*sources));
+	if (!paths || !sources) {
+		ret = -errno;
+		log_perror("Unable to read extra sources");
+		goto out;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	timeout = aux_timeout_ms();
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		++deadline.tv_sec;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	for (path = strtok_r(paths, ":", &saveptr); path && count < MAX_AUX_SOURCES; path = strtok_r(NULL, ":", &saveptr)) {
+		fds[count].fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY);
+		if (fds[count].fd < 0) {
+			ret = -errno;
+			log_msg(LOG_LEVEL_ERR, "%s: Unable to open extra source: %s", path, strerror(errno));
+			continue;
+		}
+		fds[count].events = POLLIN;
+		sources[count++].path = path;
+	}
+
+	for (pending = count; pending;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left = (int64_t)(deadline.tv_sec - now.tv_sec) * 1000000000 + (deadline.tv_nsec - now.tv_nsec);
+		if (left < 0)
+			break;
+		/* Round up, so that the last fraction of a millisecond sleeps too. */
+		timeout = (left + 999999) / 1000000;
+		if (poll(fds, count, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			log_perror("Unable to poll extra sources");
+			break;
+		}
+		for (i = 0; i < count; ++i) {
+			if (fds[i].fd < 0 || !fds[i].revents)
+				continue;
+			len = read(fds[i].fd, sources[i].buf + sources[i].len, sizeof(sources[i].buf) - sources[i].len);
+			if (len < 0 && (errno == EAGAIN || errno == EINTR))
+				continue;
+			if (len < 0) {
+				ret = -errno;
+				log_msg(LOG_LEVEL_ERR, "%s: Unable to read extra source: %s", sources[i].path, strerror(errno));
+			} else
+				sources[i].len += len;
+			if (len <= 0 || sources[i].len == sizeof(sources[i].buf)) {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				--pending;
+			}
+		}
+	}
+	for (i = 0; i < count; ++i) {
+		if (fds[i].fd >= 0)
+			close(fds[i].fd);
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (!sources[i].len)
+			continue;
+		seed_hash_update(hash, &sources[i].len, sizeof(sources[i].len));
+		seed_hash_update(hash, sources[i].buf, sources[i].len);
+		log_msg(LOG_LEVEL_INFO, "Seeding %zu bits from %s without crediting", sources[i].len * 8, sources[i].path);
+		if (seed_rng(sources[i].buf, sources[i].len, false) < 0) {
+			ret = -errno;
+			log_perror("Unable to seed");
+			continue;
+		}
+		*seeded += sources[i].len;
+	}
+
+out:
+	free(sources);
+	free(paths);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+enum jitter_params {
+	JITTER_MAX_THREADS = 8,
+	JITTER_DEFAULT_MS  = 20,
+	JITTER_MEM_SIZE    = 32768,
+	JITTER_OSR         = 8,	/* healthy samples per estimated bit */
+	JITTER_RCT_CUTOFF  = 30,	/* SP 800-90B repetition count test */
+	JITTER_APT_WINDOW  = 512,	/* SP 800-90B adaptive proportion test */
+	JITTER_APT_CUTOFF  = 325
+};
+
+struct jitter_collector {
+	uint64_t deadline;
+	uint64_t samples;
+	bool failed;
 	struct blake2s_state hash;
+	uint8_t out[BLAKE2S_HASH_LEN];
+	uint8_t mem[JITTER_MEM_SIZE];
+};
+
+static uint64_t jitter_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Measures how long a small, data dependent walk through a private
+ * buffer takes, in the style of jitterentropy.  Every delta is hashed,
+ * but only deltas whose first three derivatives are non-zero count as
+ * samples, and the output is discarded if the repetition count or
+ * adaptive proportion tests trip.
+ */
+static void *jitter_worker(void *arg)
+{
+	struct jitter_collector *c = arg;
+	uint64_t now, last, delta, prev_delta = 0, prev_delta1 = 0, apt_base = 0;
+	int64_t delta1, delta2;
+	unsigned int rct = 0, apt = 0, apt_count = 0, i;
+	size_t idx = 0;
+
+	blake2s_init(&c->hash, BLAKE2S_HASH_LEN);
+	last = jitter_now();
+	while (!c->failed) {
+		for (i = 0; i < 128; ++i) {
+			idx = (idx + 4093 + (last & 0xff)) % sizeof(c->mem);
+			c->mem[idx] += (uint8_t)(idx ^ last);
+		}
+		now = jitter_now();
+		delta = now - last;
+		delta1 = delta - prev_delta;
+		delta2 = delta1 - prev_delta1;
+		last = now;
+		blake2s_update(&c->hash, &delta, sizeof(delta));
+
+		if (delta == prev_delta) {
+			if (++rct >= JITTER_RCT_CUTOFF)
+				c->failed = true;
+		} else
+			rct = 0;
+		if (!apt_count)
+			apt_base = delta;
+		else if (delta == apt_base && ++apt >= JITTER_APT_CUTOFF)
+			c->failed = true;
+		if (++apt_count == JITTER_APT_WINDOW)
+			apt_count = apt = 0;
+
+		if (delta && delta1 && delta2)
+			++c->samples;
+		prev_delta = delta;
+		prev_delta1 = delta1;
+		if (now >= c->deadline)
+			break;
+	}
+	blake2s_final(&c->hash, c->out);
+	return NULL;
+}
+
+static unsigned int jitter_budget_ms(void)
+{
+	const char *budget = getenv("SEEDRNG_JITTER_MS");
+
+	return budget ? strtoul(budget, NULL, 10) : JITTER_DEFAULT_MS;
+}
+
+static int seed_from_cpu_jitter(unsigned int budget_ms, struct seed_hash *hash, size_t *seeded)
+{
+	uint8_t seed[JITTER_MAX_THREADS * BLAKE2S_HASH_LEN];
+	struct jitter_collector *collectors;
+#ifndef SEEDRNG_NOLIBC
+	pthread_t threads[JITTER_MAX_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+	long cpus = 1;
+#endif
+	size_t nthreads, started, i, seed_len = 0;
+	uint64_t start, samples = 0;
+	double elapsed_ms;
+
+	nthreads = cpus < 1 ? 1 : cpus > JITTER_MAX_THREADS ? JITTER_MAX_THREADS : (size_t)cpus;
+	collectors = calloc(nthreads, sizeof(*collectors));
+	if (!collectors)
+		return -1;
+	start = jitter_now();
+	for (i = 0; i < nthreads; ++i)
+		collectors[i].deadline = start + (uint64_t)budget_ms * 1000000;
+	started = 0;
+#ifndef SEEDRNG_NOLIBC
+	for (; started < nthreads; ++started) {
+		if (pthread_create(&threads[started], NULL, jitter_worker, &collectors[started]))
+			break;
+	}
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+#endif
+	if (!started)
+		jitter_worker(&collectors[started++]);
+	elapsed_ms = (jitter_now() - start) / 1e6;
+
+	for (i = 0; i < started; ++i) {
+		if (collectors[i].failed) {
+			log_msg(LOG_LEVEL_WARNING, "CPU jitter health test failed on thread %zu, discarding its output", i);
+			continue;
+		}
+		memcpy(seed + seed_len, collectors[i].out, BLAKE2S_HASH_LEN);
+		seed_len += BLAKE2S_HASH_LEN;
+		samples += collectors[i].samples;
+	}
+	free(collectors);
+	if (!seed_len) {
+		errno = EIO;
+		return -1;
+	}
+
+	seed_hash_update(hash, &seed_len, sizeof(seed_len));
+	seed_hash_update(hash, seed, seed_len);
+	log_msg(LOG_LEVEL_INFO, "Seeding %zu bits of CPU jitter without crediting (%.1f bits/ms/core over %zu cores in %.1f ms)",
+	       seed_len * 8, elapsed_ms > 0 ? samples / JITTER_OSR / elapsed_ms / started : 0.0, started, elapsed_ms);
+	if (seed_rng(seed, seed_len, false) < 0)
+		return -1;
+	*seeded += seed_len;
+	return 0;
+}
+
+/*
+ * Expands the fan-out key into len bytes for one target: keyed BLAKE2s
+ * of the target path and a block counter.  Targets are separated by
+ * their paths, and none of them reveals the key or the new seed.
+ */
+static void fanout_derive(const uint8_t key[BLAKE2S_KEY_LEN], const char *path, uint8_t *out, size_t len)
+{
+	uint8_t block[BLAKE2S_HASH_LEN];
+	uint32_t counter, le_counter;
+	struct iovec iov[] = {
+		{ .iov_base = (void *)path, .iov_len = strlen(path) + 1 },
+		{ .iov_base = &le_counter, .iov_len = sizeof(le_counter) }
+	};
+	size_t n;
+
+	for (counter = 0; len; ++counter, out += n, len -= n) {
+		le_counter = cpu_to_le32(counter);
+		blake2sv(block, sizeof(block), key, BLAKE2S_KEY_LEN, iov, ARRAY_SIZE(iov));
+		n = len < sizeof(block) ? len : sizeof(block);
+		memcpy(out, block, n);
+	}
+	memset(block, 0, sizeof(block));
+}
+
+/*
+ * Writes a derived seed to every configured fan-out target in one pass
+ * while the seed directory is still locked: all temporary files are
+ * written first, then all are synced, then all are renamed over their
+ * targets, so each consumer sees either its old or its new seed.  A
+ * dry run removes the temporary files instead of renaming them.
+ */
+static int write_fanout(const uint8_t key[BLAKE2S_KEY_LEN])
+{
+	char tmp[MAX_FANOUT_TARGETS][4096];
+	int fds[MAX_FANOUT_TARGETS];
+	uint8_t seed[MAX_SEED_LEN];
+	size_t i, written = 0;
+	int ret = 0;
+
+	TRACE1(fanout__entry, config.nr_fanout);
+	for (i = 0; i < config.nr_fanout; ++i) {
+		fds[i] = -1;
+		if ((size_t)snprintf(tmp[i], sizeof(tmp[i]), "%s.seedrng", config.fanout[i].path) >= sizeof(tmp[i])) {
+			ret = -ENAMETOOLONG;
+			log_msg(LOG_LEVEL_ERR, "%s: Unable to write fan-out seed: %s", config.fanout[i].path, strerror(ENAMETOOLONG));
+			continue;
+		}
+		fanout_derive(key, config.fanout[i].path, seed, config.fanout[i].len);
+		fds[i] = open(tmp[i], O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+		if (fds[i] < 0 || write_full(fds[i], seed, config.fanout[i].len) != (ssize_t)config.fanout[i].len) {
+			ret = -errno;
+			log_msg(LOG_LEVEL_ERR, "%s: Unable to write fan-out seed: %s", config.fanout[i].path, strerror(errno));
+			if (fds[i] >= 0) {
+				close(fds[i]);
+				unlink(tmp[i]);
+				fds[i] = -1;
+			}
+		}
+	}
+	memset(seed, 0, sizeof(seed));
+
+	for (i = 0; i < config.nr_fanout; ++i) {
+		if (fds[i] >= 0 && sync_file(fds[i]) < 0) {
+			ret = -errno;
+			log_msg(LOG_LEVEL_ERR, "%s: Unable to write fan-out seed: %s", config.fanout[i].path, strerror(errno));
+			close(fds[i]);
+			unlink(tmp[i]);
+			fds[i] = -1;
+		}
+	}
+
+	for (i = 0; i < config.nr_fanout; ++i) {
+		if (fds[i] < 0)
+			continue;
+		close(fds[i]);
+		if (dry_run)
+			unlink(tmp[i]);
+		else if (rename(tmp[i], config.fanout[i].path) < 0) {
+			ret = -errno;
+			log_msg(LOG_LEVEL_ERR, "%s: Unable to replace fan-out seed: %s", config.fanout[i].path, strerror(errno));
+			unlink(tmp[i]);
+		} else
+			++written;
+	}
+	if (written)
+		log_msg(LOG_LEVEL_INFO, "Saving derived seeds for %zu of %zu fan-out targets", written, config.nr_fanout);
+	TRACE2(fanout__return, ret, -ret);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+static bool skip_credit(void)
+{
+	const char *skip = getenv("SEEDRNG_SKIP_CREDIT");
+	return skip && (!strcmp(skip, "1") || !strcasecmp(skip, "true") ||
+			!strcasecmp(skip, "yes") || !strcasecmp(skip, "y"));
+}
+
+static int hexval(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	c = tolower(c);
+	return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static void read_boot_id(uint8_t boot_id[16])
+{
+	char str[37] = { 0 };
+	int fd, i, n = 0, hi, lo;
+
+	memset(boot_id, 0, 16);
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY);
+	if (fd < 0)
+		return;
+	if (read_full(fd, str, sizeof(str) - 1) > 0) {
+		for (i = 0; str[i] && str[i + 1] && n < 16; ++i) {
+			if (str[i] == '-')
+				continue;
+			hi = hexval(str[i]);
+			lo = hexval(str[i + 1]);
+			if (hi < 0 || lo < 0)
+				break;
+			boot_id[n++] = hi << 4 | lo;
+			++i;
+		}
+	}
+	close(fd);
+}
+
+enum pending_params {
+	PENDING_VERSION    = 3,
+	MAX_TOMBSTONES     = 4,
+	PENDING_CREDITABLE = 1 << 0
+};
+
+/*
+ * Staged in RUN_DIR while SEED_DIR is read-only, or handed over from the
+ * initramfs: the new seed, the seed files that were already consumed and
+ * must be removed before the new seed may replace them, and the hash
+ * state the new seed was finalized from, so that fragments spooled in
+ * the meantime can still be chained in.  The MAC is keyed with the boot
+ * ID, which binds the record to this boot and catches corruption; access
+ * to it is guarded by the mode of RUN_DIR.
+ */
+struct pending_record {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint32_t nr_tombstones;
+	uint32_t seed_len;
+	uint8_t boot_id[16];
+	struct tombstone tombstones[MAX_TOMBSTONES];
+	struct seed_hash chain;
+	uint8_t seed[MAX_SEED_LEN];
+	uint8_t mac[BLAKE2S_HASH_LEN];
+};
+
+static const char pending_magic[8] = "SRNGPEND";
+
+static void pending_mac(const struct pending_record *rec, uint8_t mac[BLAKE2S_HASH_LEN])
+{
+	struct iovec iov = { .iov_base = (void *)rec, .iov_len = offsetof(struct pending_record, mac) };
+
+	blake2sv(mac, BLAKE2S_HASH_LEN, rec->boot_id, sizeof(rec->boot_id), &iov, 1);
+}
+
+static bool is_read_only(int dfd)
+{
+	struct statfs st;
+
+	return !fstatfs(dfd, &st) && (st.f_flags & ST_RDONLY);
+}
+
+/* Opens and locks RUN_DIR, creating it when missing. */
+static int open_run_dir(void)
+{
+	int rdfd;
+
+	if (mkdir(run_dir(), 0700) < 0 && errno != EEXIST)
+		return -1;
+	rdfd = open(run_dir(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (rdfd >= 0 && flock(rdfd, LOCK_EX) < 0) {
+		close(rdfd);
+		return -1;
+	}
+	return rdfd;
+}
+
+/* Returns 1 if a valid record was read, 0 if there is none. */
+static int read_pending(int rdfd, struct pending_record *rec)
+{
+	uint8_t boot_id[16], mac[BLAKE2S_HASH_LEN];
+	ssize_t len;
+	int fd;
+
+	fd = openat(rdfd, PENDING_FILE, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+	len = read_full(fd, rec, sizeof(*rec));
+	close(fd);
+	if (len < 0)
+		return -1;
+	if (len != sizeof(*rec) || memcmp(rec->magic, pending_magic, sizeof(rec->magic)) ||
+	    rec->version != PENDING_VERSION || rec->nr_tombstones > MAX_TOMBSTONES ||
+	    rec->seed_len < MIN_SEED_LEN || rec->seed_len > MAX_SEED_LEN) {
+		log_msg(LOG_LEVEL_WARNING, "Ignoring invalid pending seed in %s", run_dir());
+		return 0;
+	}
+	read_boot_id(boot_id);
+	pending_mac(rec, mac);
+	if (memcmp(rec->boot_id, boot_id, sizeof(boot_id)) || memcmp(rec->mac, mac, sizeof(mac))) {
+		log_msg(LOG_LEVEL_WARNING, "Ignoring pending seed in %s from another boot or corrupted", run_dir());
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Stages the new seed and the chain it was finalized from in RUN_DIR,
+ * replacing any seed staged before in this boot, and adds the
+ * tombstones of the files that were read to the ones already recorded.
+ * RUN_DIR is expected on a tmpfs, so nothing is synced.
+ */
+static int stage_pending(const struct seed_hash *chain, const uint8_t *seed, size_t len, bool creditable,
+			 const struct tombstone *tombs, size_t nr)
+{
+	struct pending_record rec;
+	size_t i, j;
+	int rdfd, fd = -1, ret = 0;
+
+	rdfd = open_run_dir();
+	if (rdfd < 0)
+		return -1;
+	if (read_pending(rdfd, &rec) <= 0) {
+		memset(&rec, 0, sizeof(rec));
+		memcpy(rec.magic, pending_magic, sizeof(rec.magic));
+		rec.version = PENDING_VERSION;
+	}
+	for (i = 0; i < nr; ++i) {
+		if (!tombs[i].ino)
+			continue;
+		for (j = 0; j < rec.nr_tombstones; ++j) {
+			if (tombs[i].dev == rec.tombstones[j].dev && tombs[i].ino == rec.tombstones[j].ino)
+				break;
+		}
+		if (j == rec.nr_tombstones && j < MAX_TOMBSTONES)
+			rec.tombstones[rec.nr_tombstones++] = tombs[i];
+	}
+	rec.flags = creditable ? PENDING_CREDITABLE : 0;
+	rec.seed_len = len;
+	read_boot_id(rec.boot_id);
+	rec.chain = *chain;
+	memset(rec.seed, 0, sizeof(rec.seed));
+	memcpy(rec.seed, seed, len);
+	pending_mac(&rec, rec.mac);
+
+	fd = openat(rdfd, PENDING_FILE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0400);
+	if (fd < 0 || write_full(fd, &rec, sizeof(rec)) != sizeof(rec) ||
+	    renameat(rdfd, PENDING_FILE ".tmp", rdfd, PENDING_FILE) < 0)
+		ret = -errno;
+	if (fd >= 0)
+		close(fd);
+	close(rdfd);
+	memset(&rec, 0, sizeof(rec));
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+/* Removes name from the seed directory if it is one of the tombstones. */
+static int remove_tombstoned(int dfd, const char *name, const struct pending_record *rec)
+{
+	struct stat st;
+	uint32_t i;
+
+	if (fstatat(dfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+		return errno == ENOENT ? 0 : -1;
+	for (i = 0; i < rec->nr_tombstones; ++i) {
+		if (rec->tombstones[i].dev == (uint64_t)st.st_dev && rec->tombstones[i].ino == (uint64_t)st.st_ino &&
+		    rec->tombstones[i].size == (uint64_t)st.st_size)
+			return unlinkat(dfd, name, 0);
+	}
+	return 0;
+}
+
+/*
+ * Moves a seed staged by stage_pending() into the seed directory dfd,
+ * which must be locked and writable.  The seed files it was chained from
+ * are removed first.  If a seed file is left after that, a run that
+ * found the seed directory writable has already replaced them with a
+ * newer seed, or the staging run never saw it, such as an initramfs
+ * with a seed directory of its own.  Either way the staged seed is
+ * dropped, so that the caller's run consumes the seed file and saves
+ * a new one.  Otherwise fragments spooled in the meantime are chained
+ * in from the staged hash state, so that committing never has to hash
+ * the seed files or read a new seed again.  Returns 1 if a staged seed
+ * was committed, and 0 if there was none or it was dropped, leaving the
+ * seed files to the caller's run.
+ */
+static int commit_pending_at(int dfd)
+{
+	struct pending_record rec;
+	const char *name = NON_CREDITABLE_SEED;
+	struct stat st;
+	size_t seeded = 0;
+	int rdfd, fd = -1, ret = 0, found;
+
+	rdfd = open(run_dir(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (rdfd < 0 && errno == ENOENT)
+		return 0;
+	if (rdfd < 0 || flock(rdfd, LOCK_EX) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	found = read_pending(rdfd, &rec);
+	if (found <= 0) {
+		ret = found < 0 ? -errno : 0;
+		goto out;
+	}
+
+	if (remove_tombstoned(dfd, NON_CREDITABLE_SEED, &rec) < 0 ||
+	    remove_tombstoned(dfd, CREDITABLE_SEED, &rec) < 0 || fsync(dfd) < 0) {
+		ret = -errno;
+		log_perror("Unable to remove seed consumed while read-only");
+		goto out;
+	}
+	if (!fstatat(dfd, NON_CREDITABLE_SEED, &st, AT_SYMLINK_NOFOLLOW) ||
+	    !fstatat(dfd, CREDITABLE_SEED, &st, AT_SYMLINK_NOFOLLOW)) {
+		log_msg(LOG_LEVEL_INFO, "Seed files the pending seed was not chained from remain, dropping it");
+		ret = unlinkat(rdfd, PENDING_FILE, 0) < 0 ? -errno : 0;
+		goto out;
+	}
+	if (seed_from_spool_if_exists(dfd, !skip_credit(), &rec.chain, &seeded) < 0)
+		log_perror("Unable to consume spooled seed fragments");
+	if (seeded)
+		seed_hash_final(&rec.chain, rec.seed + rec.seed_len - BLAKE2S_HASH_LEN);
+
+	fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0400);
+	if (fd < 0 || write_full(fd, rec.seed, rec.seed_len) != rec.seed_len || sync_file(fd) < 0) {
+		ret = -errno;
+		log_perror("Unable to write pending seed");
+		goto out;
+	}
+	if ((rec.flags & PENDING_CREDITABLE) && renameat(dfd, NON_CREDITABLE_SEED, dfd, CREDITABLE_SEED) < 0) {
+		ret = -errno;
+		log_perror("Unable to make pending seed creditable");
+		goto out;
+	}
+	log_msg(LOG_LEVEL_INFO, "Committed %u bits of %s seed staged in %s", rec.seed_len * 8,
+		rec.flags & PENDING_CREDITABLE ? "creditable" : "non-creditable", run_dir());
+	ret = unlinkat(rdfd, PENDING_FILE, 0) < 0 ? -errno : 1;
+
+out:
+	memset(&rec, 0, sizeof(rec));
+	if (fd >= 0)
+		close(fd);
+	if (rdfd >= 0)
+		close(rdfd);
+	errno = ret < 0 ? -ret : 0;
+	return ret < 0 ? -1 : ret;
+}
+
+/* Commits the pending seed, failing with EROFS while still read-only. */
+static int commit_pending(void)
+{
+	int dfd, ret;
+
+	if (mkdir(seed_dir(), 0700) < 0 && errno != EEXIST)
+		return -1;
+	dfd = open(seed_dir(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (dfd < 0)
+		return -1;
+	if (flock(dfd, LOCK_EX) < 0)
+		ret = -errno;
+	else if (is_read_only(dfd))
+		ret = -EROFS;
+	else {
+		read_config(dfd);
+		ret = commit_pending_at(dfd) < 0 ? -errno : 0;
+	}
+	close(dfd);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+enum watcher_params {
+	WATCHER_LIFETIME_S = 86400
+};
+
+static int64_t boottime_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_BOOTTIME, &now);
+	return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Commits the pending seed from a detached child as soon as the seed
+ * directory becomes writable, so that the boot path never waits for the
+ * root file system to be remounted.  The child sleeps in epoll_wait(2)
+ * on /proc/self/mountinfo, which signals every change of the mount table
+ * with POLLPRI, and retries after each.  Only one child watches at a
+ * time, holding WATCHER_LOCK, and it gives up after a day, leaving the
+ * pending seed to `seedrng commit' or the next run.
+ */
+static void spawn_commit_watcher(void)
+{
+	struct epoll_event ev = { .events = EPOLLPRI | EPOLLERR };
+	int64_t deadline;
+	int efd, mfd, lfd, rdfd, null, status, timeout;
+	pid_t pid;
+
+	rdfd = open(run_dir(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	lfd = rdfd < 0 ? -1 : openat(rdfd, WATCHER_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (rdfd >= 0)
+		close(rdfd);
+	if (lfd < 0) {
+		log_perror("Unable to start commit watcher");
+		return;
+	}
+	/* The lock is shared with the child, and lives on in the watcher. */
+	if (flock(lfd, LOCK_EX | LOCK_NB) < 0) {
+		if (errno != EWOULDBLOCK)
+			log_perror("Unable to start commit watcher");
+		close(lfd);
+		return;
+	}
+	pid = fork();
+	if (pid < 0) {
+		log_perror("Unable to start commit watcher");
+		close(lfd);
+		return;
+	}
+	if (pid) {
+		close(lfd);
+		waitpid(pid, &status, 0);
+		return;
+	}
+	/* Reparent to init, so that nobody has to wait for us. */
+	setsid();
+	if (fork())
+		_exit(0);
+	null = open("/dev/null", O_RDWR);
+	if (null >= 0) {
+		dup2(null, STDIN_FILENO);
+		dup2(null, STDOUT_FILENO);
+		if (!logger.kmsg && logger.fd <= STDERR_FILENO)
+			dup2(null, STDERR_FILENO);
+		if (null > STDERR_FILENO)
+			close(null);
+	}
+
+	efd = epoll_create1(EPOLL_CLOEXEC);
+	mfd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+	ev.data.fd = mfd;
+	if (efd < 0 || mfd < 0 || epoll_ctl(efd, EPOLL_CTL_ADD, mfd, &ev) < 0) {
+		log_perror("Unable to watch mount table");
+		_exit(1);
+	}
+	deadline = boottime_ns() + (int64_t)WATCHER_LIFETIME_S * 1000000000;
+	while (commit_pending() < 0) {
+		if (errno != EROFS) {
+			log_perror("Unable to commit pending seed");
+			_exit(1);
+		}
+		timeout = (deadline - boottime_ns()) / 1000000;
+		if (timeout <= 0) {
+			log_msg(LOG_LEVEL_WARNING, "%s is still read-only, leaving the pending seed in %s",
+				seed_dir(), run_dir());
+			_exit(1);
+		}
+		if (epoll_wait(efd, &ev, 1, timeout) < 0 && errno != EINTR) {
+			log_perror("Unable to watch mount table");
+			_exit(1);
+		}
+	}
+	_exit(0);
+}
+
+static int cmd_commit(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+	if (getuid()) {
+		errno = EACCES;
+		log_perror("This program requires root");
+		return 1;
+	}
+	if (commit_pending() < 0) {
+		log_perror("Unable to commit pending seed");
+		return 1;
+	}
+	return 0;
+}
+
+#ifndef SEEDRNG_NOLIBC
+/* Parses a whole decimal option argument between min and max. */
+static int parse_long_arg(const char *arg, long min, long max, long *out)
+{
+	char *end;
+	long v;
+
+	errno = 0;
+	v = strtol(arg, &end, 10);
+	if (end == arg || *end || errno || v < min || v > max)
+		return -1;
+	*out = v;
+	return 0;
+}
+
+struct provision_job {
+	char *const *roots;
+	size_t count;
+	size_t next;
+	size_t done;
+	const uint8_t *seeds;
+	size_t seed_len;
+	bool creditable;
+	struct timespec realtime, boottime;
+	pthread_mutex_t lock;
+};
+
+/*
+ * Opens SEED_DIR below root, creating missing components if create is
+ * set.  Symlinks are never followed, so that a hostile image cannot
+ * redirect us outside of its root.
+ */
+static int open_seed_dir_at(const char *root, bool create)
+{
+	char path[] = SEED_DIR;
+	char *component, *saveptr = NULL;
+	int dfd, next;
+
+	dfd = open(root, O_DIRECTORY | O_RDONLY);
+	if (dfd < 0)
+		return -1;
+	for (component = strtok_r(path, "/", &saveptr); component; component = strtok_r(NULL, "/", &saveptr)) {
+		if (create && mkdirat(dfd, component, 0700) < 0 && errno != EEXIST)
+			goto err;
+		next = openat(dfd, component, O_DIRECTORY | O_RDONLY | O_NOFOLLOW);
+		if (next < 0)
+			goto err;
+		close(dfd);
+		dfd = next;
+	}
+	return dfd;
+
+err:
+	next = errno;
+	close(dfd);
+	errno = next;
+	return -1;
+}
+
+static int provision_one(struct provision_job *job, size_t i)
+{
+	static const char seedrng_prefix[] = "SeedRNG v1 Provision Prefix";
+	const char *root = job->roots[i];
+	size_t root_len = strlen(root), seed_len = job->seed_len;
+	uint8_t seed[MAX_SEED_LEN];
+	const struct iovec fields[] = {
+		{ .iov_base = (void *)seedrng_prefix, .iov_len = sizeof(seedrng_prefix) - 1 },
+		{ .iov_base = &job->realtime, .iov_len = sizeof(job->realtime) },
+		{ .iov_base = &job->boottime, .iov_len = sizeof(job->boottime) },
+		{ .iov_base = &root_len, .iov_len = sizeof(root_len) },
+		{ .iov_base = (void *)root, .iov_len = root_len },
+		{ .iov_base = &seed_len, .iov_len = sizeof(seed_len) },
+		{ .iov_base = seed, .iov_len = seed_len }
+	};
+	int dfd, fd = -1, ret = 0;
+
+	memcpy(seed, job->seeds + i * seed_len, seed_len);
+	blake2sv(seed + seed_len - BLAKE2S_HASH_LEN, BLAKE2S_HASH_LEN, NULL, 0, fields, ARRAY_SIZE(fields));
+
+	dfd = open_seed_dir_at(root, true);
+	if (dfd < 0 || flock(dfd, LOCK_EX) < 0) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to lock seed directory: %s\n", root, strerror(errno));
+		goto out;
+	}
+	/* Whatever seed the image was cloned with is shared, so drop it. */
+	if ((unlinkat(dfd, CREDITABLE_SEED, 0) < 0 && errno != ENOENT) ||
+	    (unlinkat(dfd, NON_CREDITABLE_SEED, 0) < 0 && errno != ENOENT)) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to remove cloned seed: %s\n", root, strerror(errno));
+		goto out;
+	}
+	fd = openat(dfd, NON_CREDITABLE_SEED, O_WRONLY | O_CREAT | O_TRUNC, 0400);
+	if (fd < 0) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to open seed file for writing: %s\n", root, strerror(errno));
+		goto out;
+	}
+	if (write_full(fd, seed, seed_len) != (ssize_t)seed_len || fsync(fd) < 0) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to write seed file: %s\n", root, strerror(errno));
+		goto out;
+	}
+	if (job->creditable && renameat(dfd, NON_CREDITABLE_SEED, dfd, CREDITABLE_SEED) < 0) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to make new seed creditable: %s\n", root, strerror(errno));
+		goto out;
+	}
+	if (fsync(dfd) < 0) {
+		ret = -errno;
+		fprintf(stderr, "%s: Unable to sync seed directory: %s\n", root, strerror(errno));
+	}
+
+out:
+	if (fd >= 0)
+		close(fd);
+	if (dfd >= 0)
+		close(dfd);
+	return ret;
+}
+
+static void *provision_worker(void *arg)
+{
+	struct provision_job *job = arg;
+	size_t i, done = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		job->done += done;
+		i = job->next < job->count ? job->next++ : job->count;
+		pthread_mutex_unlock(&job->lock);
+		if (i == job->count)
+			break;
+		done = provision_one(job, i) == 0;
+	}
+	return NULL;
+}
+
+static int cmd_provision(int argc, char *argv[])
+{
+	struct provision_job job = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	struct timespec start, end;
+	pthread_t *threads = NULL;
+	uint8_t *seeds = NULL;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t nthreads, i;
+	double elapsed;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "j:")) != -1) {
+		switch (opt) {
+		case 'j':
+			if (parse_long_arg(optarg, 1, LONG_MAX, &jobs) < 0)
+				goto usage;
+			break;
+		default:
+usage:
+			fprintf(stderr, "usage: seedrng provision [-j jobs] root...\n");
+			return 1;
+		}
+	}
+	if (optind == argc) {
+		fprintf(stderr, "usage: seedrng provision [-j jobs] root...\n");
+		return 1;
+	}
+	job.roots = argv + optind;
+	job.count = argc - optind;
+	job.seed_len = determine_optimal_seed_len();
+	nthreads = jobs < 1 ? 1 : (size_t)jobs;
+	if (nthreads > job.count)
+		nthreads = job.count;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_REALTIME, &job.realtime);
+	clock_gettime(CLOCK_BOOTTIME, &job.boottime);
+
+	/* One large read from the kernel, split between all targets. */
+	if (job.count > SIZE_MAX / job.seed_len ||
+	    !(seeds = malloc(job.count * job.seed_len)) ||
+	    !(threads = calloc(nthreads, sizeof(*threads)))) {
+		perror("Unable to allocate seeds");
+		goto out;
+	}
+	if (read_new_seed(seeds, job.count * job.seed_len, &job.creditable) < 0) {
+		perror("Unable to read new seeds");
+		goto out;
+	}
+	job.seeds = seeds;
+
+	for (i = 0; i < nthreads; ++i) {
+		if (pthread_create(&threads[i], NULL, provision_worker, &job)) {
+			fprintf(stderr, "Unable to start worker thread\n");
+			break;
+		}
+	}
+	if (!i)
+		provision_worker(&job);
+	while (i)
+		pthread_join(threads[--i], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("Provisioned %zu of %zu images with %zu bits of %s seed in %.3f s (%.1f images/s)\n",
+	       job.done, job.count, job.seed_len * 8, job.creditable ? "creditable" : "non-creditable",
+	       elapsed, elapsed > 0 ? job.done / elapsed : 0.0);
+	ret = job.done == job.count ? 0 : 1;
+
+out:
+	free(threads);
+	free(seeds);
+	return ret;
+}
+
+enum audit_params {
+	AUDIT_DEFAULT_STALE_DAYS = 30,
+	AUDIT_SEEDS              = 2,	/* per root: non-creditable, creditable */
+	NR_AUDIT_STATUS          = 5
+};
+
+enum audit_status {
+	AUDIT_MISSING   = 1 << 0,
+	AUDIT_EMPTY     = 1 << 1,
+	AUDIT_STALE     = 1 << 2,
+	AUDIT_DUPLICATE = 1 << 3,
+	AUDIT_ERROR     = 1 << 4
+};
+
+struct audit_result {
+	uint8_t fingerprint[AUDIT_SEEDS][BLAKE2S_HASH_LEN];
+	bool found[AUDIT_SEEDS];
+	unsigned int status;
+	time_t mtime;
+	int error;
+	size_t duplicate_of;
+};
+
+/*
+ * The roots not yet audited by one worker: it takes them from the
+ * front, and others that ran out steal the back half.
+ */
+struct audit_range {
+	pthread_mutex_t lock;
+	size_t next, end;
+};
+
+struct audit_job {
+	char **roots;
+	size_t count;
+	struct audit_result *results;
+	struct audit_range *ranges;
+	size_t nthreads;
+	uint8_t key[BLAKE2S_KEY_LEN];
+	time_t stale_before;
+};
+
+struct audit_worker {
+	struct audit_job *job;
+	size_t self;
+};
+
+/* A root is never rewritten, and seeds are only fingerprinted. */
+static void audit_one(struct audit_job *job, size_t i)
+{
+	static const char *const names[AUDIT_SEEDS] = { NON_CREDITABLE_SEED, CREDITABLE_SEED };
+	struct audit_result *result = &job->results[i];
+	uint8_t seed[MAX_SEED_LEN];
+	struct iovec iov = { .iov_base = seed };
+	struct stat st;
+	ssize_t len;
+	size_t n;
+	int dfd, fd;
+
+	dfd = open_seed_dir_at(job->roots[i], false);
+	if (dfd < 0) {
+		result->status = errno == ENOENT ? AUDIT_MISSING : AUDIT_ERROR;
+		result->error = errno;
+		return;
+	}
+	for (n = 0; n < AUDIT_SEEDS; ++n) {
+		fd = openat(dfd, names[n], O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno != ENOENT) {
+				result->status |= AUDIT_ERROR;
+				result->error = errno;
+			}
+			continue;
+		}
+		len = fstat(fd, &st) < 0 ? -1 : read_full(fd, seed, sizeof(seed));
+		close(fd);
+		if (len < 0) {
+			result->status |= AUDIT_ERROR;
+			result->error = errno;
+			continue;
+		}
+		if (!len) {
+			result->status |= AUDIT_EMPTY;
+			continue;
+		}
+		if (st.st_mtime > result->mtime)
+			result->mtime = st.st_mtime;
+		iov.iov_len = len;
+		blake2sv(result->fingerprint[n], BLAKE2S_HASH_LEN, job->key, BLAKE2S_KEY_LEN, &iov, 1);
+		result->found[n] = true;
+	}
+	memset(seed, 0, sizeof(seed));
+	close(dfd);
+	if (!result->found[0] && !result->found[1] && !result->status)
+		result->status = AUDIT_MISSING;
+	else if ((result->found[0] || result->found[1]) && result->mtime < job->stale_before)
+		result->status |= AUDIT_STALE;
+}
+
+static size_t audit_range_left(struct audit_range *range)
+{
+	size_t left;
+
+	pthread_mutex_lock(&range->lock);
+	left = range->end - range->next;
+	pthread_mutex_unlock(&range->lock);
+	return left;
+}
+
+/*
+ * Takes the next root from the worker's own range, or else steals the
+ * back half of the fullest other range, so that workers stuck on slow
+ * roots, such as cold network mounts, hand off what they have not
+ * started.  Returns false once every range is empty.
+ */
+static bool audit_take(struct audit_job *job, size_t self, size_t *i)
+{
+	struct audit_range *own = &job->ranges[self], *victim;
+	size_t v, best, left, most, start, end;
+
+	pthread_mutex_lock(&own->lock);
+	if (own->next < own->end) {
+		*i = own->next++;
+		pthread_mutex_unlock(&own->lock);
+		return true;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	for (;;) {
+		best = self;
+		most = 0;
+		for (v = 0; v < job->nthreads; ++v) {
+			if (v != self && (left = audit_range_left(&job->ranges[v])) > most) {
+				best = v;
+				most = left;
+			}
+		}
+		if (best == self)
+			return false;
+		victim = &job->ranges[best];
+		pthread_mutex_lock(&victim->lock);
+		left = victim->end - victim->next;
+		end = victim->end;
+		start = end - (left + 1) / 2;
+		victim->end = start;
+		pthread_mutex_unlock(&victim->lock);
+		if (!left)
+			continue;
+		pthread_mutex_lock(&own->lock);
+		own->next = start + 1;
+		own->end = end;
+		pthread_mutex_unlock(&own->lock);
+		*i = start;
+		return true;
+	}
+}
+
+static void *audit_worker(void *arg)
+{
+	struct audit_worker *worker = arg;
+	size_t i;
+
+	while (audit_take(worker->job, worker->self, &i))
+		audit_one(worker->job, i);
+	return NULL;
+}
+
+/*
+ * Finds seeds shared between roots with an open addressing table keyed
+ * by the fingerprints, which are uniformly distributed already.  Every
+ * root sharing a seed with an earlier one is marked as its duplicate.
+ */
+static int audit_find_duplicates(struct audit_job *job)
+{
+	struct audit_slot {
+		const uint8_t *fingerprint;
+		size_t root;
+	} *slots;
+	size_t capacity = 16, i, n, h;
+	uint64_t key;
+
+	while (capacity < job->count * AUDIT_SEEDS * 2)
+		capacity <<= 1;
+	slots = calloc(capacity, sizeof(*slots));
+	if (!slots)
+		return -1;
+	for (i = 0; i < job->count; ++i) {
+		for (n = 0; n < AUDIT_SEEDS; ++n) {
+			if (!job->results[i].found[n])
+				continue;
+			memcpy(&key, job->results[i].fingerprint[n], sizeof(key));
+			for (h = key & (capacity - 1); slots[h].fingerprint; h = (h + 1) & (capacity - 1)) {
+				if (!memcmp(slots[h].fingerprint, job->results[i].fingerprint[n], BLAKE2S_HASH_LEN))
+					break;
+			}
+			if (!slots[h].fingerprint) {
+				slots[h].fingerprint = job->results[i].fingerprint[n];
+				slots[h].root = i;
+			} else if (slots[h].root != i && !(job->results[i].status & AUDIT_DUPLICATE)) {
+				job->results[i].status |= AUDIT_DUPLICATE;
+				job->results[i].duplicate_of = slots[h].root;
+			}
+		}
+	}
+	free(slots);
+	return 0;
+}
+
+/* Reads one root per line, for more roots than fit on a command line. */
+static char **audit_read_roots(FILE *in, size_t *count)
+{
+	char **roots, **new_roots, *line = NULL;
+	size_t alloc = 1024, size = 0;
+	ssize_t len;
+
+	*count = 0;
+	roots = malloc(alloc * sizeof(*roots));
+	if (!roots)
+		return NULL;
+	while ((len = getline(&line, &size, in)) > 0) {
+		if (line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (!len)
+			continue;
+		if (*count == alloc) {
+			alloc *= 2;
+			new_roots = realloc(roots, alloc * sizeof(*roots));
+			if (!new_roots)
+				goto err;
+			roots = new_roots;
+		}
+		if (!(roots[*count] = strdup(line)))
+			goto err;
+		++*count;
+	}
+	free(line);
+	if (ferror(in))
+		goto err;
+	return roots;
+
+err:
+	while (*count)
+		free(roots[--*count]);
+	free(roots);
+	free(line);
+	return NULL;
+}
+
+static int cmd_audit(int argc, char *argv[])
+{
+	struct audit_job job = { .roots = NULL };
+	struct audit_worker *workers = NULL;
+	struct timespec start, end;
+	pthread_t *threads = NULL;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN), stale_days = AUDIT_DEFAULT_STALE_DAYS;
+	size_t i, started, problems = 0, counts[NR_AUDIT_STATUS] = { 0 };
+	bool from_stdin;
+	double elapsed;
+	int opt, bit, ret = 1;
+
+	while ((opt = getopt(argc, argv, "j:s:")) != -1) {
+		switch (opt) {
+		case 'j':
+			if (parse_long_arg(optarg, 1, LONG_MAX, &jobs) < 0)
+				goto usage;
+			break;
+		case 's':
+			if (parse_long_arg(optarg, 0, INT_MAX / 86400, &stale_days) < 0)
+				goto usage;
+			break;
+		default:
+usage:
+			fprintf(stderr, "usage: seedrng audit [-j jobs] [-s days] [root...]\n");
+			return 1;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	from_stdin = optind == argc;
+	if (from_stdin) {
+		job.roots = audit_read_roots(stdin, &job.count);
+		if (!job.roots) {
+			perror("Unable to read roots");
+			return 1;
+		}
+	} else {
+		job.roots = argv + optind;
+		job.count = argc - optind;
+	}
+	job.stale_before = stale_days > 0 ? time(NULL) - stale_days * 86400 : 0;
+	job.nthreads = jobs < 1 ? 1 : (size_t)jobs;
+	if (job.nthreads > job.count)
+		job.nthreads = job.count ? job.count : 1;
+
+	/* A key of our own keeps fingerprints from revealing the seeds. */
+	if (getrandom_full(job.key, sizeof(job.key), 0) != sizeof(job.key)) {
+		perror("Unable to read fingerprint key");
+		goto out;
+	}
+	job.results = calloc(job.count ? job.count : 1, sizeof(*job.results));
+	job.ranges = calloc(job.nthreads, sizeof(*job.ranges));
+	workers = calloc(job.nthreads, sizeof(*workers));
+	threads = calloc(job.nthreads, sizeof(*threads));
+	if (!job.results || !job.ranges || !workers || !threads) {
+		perror("Unable to allocate audit");
+		goto out;
+	}
+	for (i = 0; i < job.nthreads; ++i) {
+		pthread_mutex_init(&job.ranges[i].lock, NULL);
+		job.ranges[i].next = job.count * i / job.nthreads;
+		job.ranges[i].end = job.count * (i + 1) / job.nthreads;
+		workers[i].job = &job;
+		workers[i].self = i;
+	}
+	/* The calling thread is worker 0. */
+	for (started = 1; started < job.nthreads; ++started) {
+		if (pthread_create(&threads[started], NULL, audit_worker, &workers[started]))
+			break;
+	}
+	audit_worker(&workers[0]);
+	/* Ranges of workers that could not be started are stolen by the rest. */
+	while (started > 1)
+		pthread_join(threads[--started], NULL);
+	if (audit_find_duplicates(&job) < 0) {
+		perror("Unable to index fingerprints");
+		goto out;
+	}
+
+	for (i = 0; i < job.count; ++i) {
+		const struct audit_result *result = &job.results[i];
+
+		if (!result->status)
+			continue;
+		++problems;
+		for (bit = 0; bit < NR_AUDIT_STATUS; ++bit)
+			counts[bit] += !!(result->status & 1 << bit);
+		if (result->status & AUDIT_MISSING)
+			printf("%s: missing\n", job.roots[i]);
+		if (result->status & AUDIT_EMPTY)
+			printf("%s: empty\n", job.roots[i]);
+		if (result->status & AUDIT_STALE)
+			printf("%s: stale, last written %ld days ago\n", job.roots[i],
+			       (long)(time(NULL) - result->mtime) / 86400);
+		if (result->status & AUDIT_DUPLICATE)
+			printf("%s: same seed as %s\n", job.roots[i], job.roots[result->duplicate_of]);
+		if (result->status & AUDIT_ERROR)
+			printf("%s: %s\n", job.roots[i], strerror(result->error));
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "Audited %zu roots in %.3f s (%.1f roots/s): %zu missing, %zu empty, %zu stale, "
+		"%zu duplicated, %zu unreadable\n", job.count, elapsed, elapsed > 0 ? job.count / elapsed : 0.0,
+		counts[0], counts[1], counts[2], counts[3], counts[4]);
+	ret = problems ? 1 : 0;
+
+out:
+	memset(job.key, 0, sizeof(job.key));
+	if (job.ranges) {
+		for (i = 0; i < job.nthreads; ++i)
+			pthread_mutex_destroy(&job.ranges[i].lock);
+	}
+	if (from_stdin && job.roots) {
+		for (i = 0; i < job.count; ++i)
+			free(job.roots[i]);
+		free(job.roots);
+	}
+	free(job.ranges);
+	free(job.results);
+	free(workers);
+	free(threads);
+	return ret;
+}
+
+enum serve_params {
+	SERVE_DEFAULT_POOL = 1024,	/* seeds */
+	SERVE_BATCH        = 256,	/* seeds per read from the kernel */
+	SERVE_BACKLOG      = 128,
+	SERVE_MAX_CLIENTS  = 64,	/* connected, request not yet read */
+	SERVE_TIMEOUT_MS   = 100,	/* for a client to send its request */
+	SERVE_REQUEST_MAX  = 16
+};
+
+/*
+ * Seeds ready to be handed out, in a ring of size slots with the oldest
+ * at head.  The refill thread tops the ring up to full whenever it
+ * drains to half, so that handing out a seed only waits for the kernel
+ * once the pool has run dry.
+ */
+struct seed_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t low, filled;
+	uint8_t *seeds, *batch;
+	size_t size, seed_len, head, depth;
+	bool stop, failed;
+	struct timespec start, realtime, boottime;
+	uint64_t generated, served, dry, refills, refill_ns;
+};
+
+/* Makes every seed of the batch unique to this pool and its position. */
+static void seed_pool_condition(struct seed_pool *pool, size_t n, uint64_t counter)
+{
+	static const char seedrng_prefix[] = "SeedRNG v1 Serve Prefix";
+	size_t seed_len = pool->seed_len, i;
+	struct iovec fields[] = {
+		{ .iov_base = (void *)seedrng_prefix, .iov_len = sizeof(seedrng_prefix) - 1 },
+		{ .iov_base = &pool->realtime, .iov_len = sizeof(pool->realtime) },
+		{ .iov_base = &pool->boottime, .iov_len = sizeof(pool->boottime) },
+		{ .iov_base = &counter, .iov_len = sizeof(counter) },
+		{ .iov_base = &seed_len, .iov_len = sizeof(seed_len) },
+		{ .iov_len = seed_len }
+	};
+
+	for (i = 0; i < n; ++i, ++counter) {
+		fields[ARRAY_SIZE(fields) - 1].iov_base = pool->batch + i * seed_len;
+		blake2sv(pool->batch + (i + 1) * seed_len - BLAKE2S_HASH_LEN, BLAKE2S_HASH_LEN, NULL, 0,
+			 fields, ARRAY_SIZE(fields));
+	}
+}
+
+static void *seed_pool_refill(void *arg)
+{
+	struct seed_pool *pool = arg;
+	size_t seed_len = pool->seed_len, n, i, tail;
+	struct timespec start, end;
+	bool filling = false;
+	uint64_t counter;
+
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		if (pool->depth == pool->size)
+			filling = false;
+		else if (pool->depth <= pool->size / 2)
+			filling = true;
+		if (!filling) {
+			pthread_cond_wait(&pool->low, &pool->lock);
+			continue;
+		}
+		/* Only this thread adds seeds, so there is room for them. */
+		n = pool->size - pool->depth < SERVE_BATCH ? pool->size - pool->depth : SERVE_BATCH;
+		counter = pool->generated;
+		pthread_mutex_unlock(&pool->lock);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (getrandom_full(pool->batch, n * seed_len, 0) != (ssize_t)(n * seed_len)) {
+			log_perror("Unable to refill seed pool");
+			pthread_mutex_lock(&pool->lock);
+			pool->failed = true;
+			pthread_cond_broadcast(&pool->filled);
+			break;
+		}
+		seed_pool_condition(pool, n, counter);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		pthread_mutex_lock(&pool->lock);
+		for (i = 0; i < n; ++i) {
+			tail = (pool->head + pool->depth++) % pool->size;
+			memcpy(pool->seeds + tail * seed_len, pool->batch + i * seed_len, seed_len);
+		}
+		memset(pool->batch, 0, n * seed_len);
+		pool->generated += n;
+		++pool->refills;
+		pool->refill_ns += timespec_diff_ns(&start, &end);
+		pthread_cond_broadcast(&pool->filled);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* Hands out the oldest seed and wipes it from the pool. */
+static int seed_pool_take(struct seed_pool *pool, uint8_t *seed)
+{
+	uint8_t *slot;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->depth)
+		++pool->dry;
+	while (!pool->depth && !pool->failed)
+		pthread_cond_wait(&pool->filled, &pool->lock);
+	if (!pool->depth) {
+		pthread_mutex_unlock(&pool->lock);
+		errno = EIO;
+		return -1;
+	}
+	slot = pool->seeds + pool->head * pool->seed_len;
+	memcpy(seed, slot, pool->seed_len);
+	memset(slot, 0, pool->seed_len);
+	pool->head = (pool->head + 1) % pool->size;
+	--pool->depth;
+	++pool->served;
+	if (pool->depth <= pool->size / 2)
+		pthread_cond_signal(&pool->low);
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+static int seed_pool_stats(struct seed_pool *pool, char *buf, size_t size)
+{
+	struct timespec now;
+	double uptime;
+	int len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	uptime = timespec_diff_ns(&pool->start, &now) / 1e9;
+	pthread_mutex_lock(&pool->lock);
+	len = snprintf(buf, size,
+		       "pool_size %zu\n"
+		       "pool_depth %zu\n"
+		       "seed_bits %zu\n"
+		       "seeds_served %llu\n"
+		       "seeds_generated %llu\n"
+		       "pool_dry %llu\n"
+		       "refills %llu\n"
+		       "refill_failed %d\n"
+		       "refill_seeds_per_s %.1f\n"
+		       "served_seeds_per_s %.1f\n"
+		       "uptime_s %.3f\n",
+		       pool->size, pool->depth, pool->seed_len * 8,
+		       (unsigned long long)pool->served, (unsigned long long)pool->generated,
+		       (unsigned long long)pool->dry, (unsigned long long)pool->refills, pool->failed,
+		       pool->refill_ns ? pool->generated / (pool->refill_ns / 1e9) : 0.0,
+		       uptime > 0 ? pool->served / uptime : 0.0, uptime);
+	pthread_mutex_unlock(&pool->lock);
+	return len < 0 || (size_t)len >= size ? -1 : len;
+}
+
+/*
+ * Answers one request: "seed" for a seed, "stats" for metrics.  Fails
+ * only if the pool ran dry for good.
+ */
+static int serve_request(struct seed_pool *pool, int fd, char *request)
+{
+	char stats[512];
+	uint8_t seed[MAX_SEED_LEN];
+	int len;
+
+	request[strcspn(request, "\r\n")] = '\0';
+	if (!strcmp(request, "seed")) {
+		if (seed_pool_take(pool, seed) < 0)
+			return -1;
+		if (write_full(fd, seed, pool->seed_len) != (ssize_t)pool->seed_len)
+			log_perror("Unable to hand out seed");
+		memset(seed, 0, sizeof(seed));
+	} else if (!strcmp(request, "stats")) {
+		len = seed_pool_stats(pool, stats, sizeof(stats));
+		if (len > 0)
+			write_full(fd, stats, len);
+	}
+	return 0;
+}
+
+/*
+ * Binds path, unless another server is still answering on it.  A socket
+ * left behind by a server that was killed is replaced, anything else is
+ * left alone.
+ */
+static int serve_bind(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, probe, ret;
+
+	if (!lstat(addr->sun_path, &st)) {
+		if (!S_ISSOCK(st.st_mode)) {
+			errno = EEXIST;
+			return -1;
+		}
+		probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (probe < 0)
+			return -1;
+		ret = connect(probe, (const struct sockaddr *)addr, sizeof(*addr));
+		close(probe);
+		if (!ret) {
+			errno = EADDRINUSE;
+			return -1;
+		}
+		if (errno != ECONNREFUSED || unlink(addr->sun_path) < 0)
+			return -1;
+	} else if (errno != ENOENT)
+		return -1;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (bind(fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 || listen(fd, SERVE_BACKLOG) < 0) {
+		ret = errno;
+		close(fd);
+		errno = ret;
+		return -1;
+	}
+	return fd;
+}
+
+static int64_t serve_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int cmd_serve(int argc, char *argv[])
+{
+	struct seed_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.low = PTHREAD_COND_INITIALIZER,
+		.filled = PTHREAD_COND_INITIALIZER
+	};
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct signalfd_siginfo si;
+	/* The socket, the signals, and clients yet to send their request. */
+	struct pollfd fds[2 + SERVE_MAX_CLIENTS];
+	int64_t deadlines[SERVE_MAX_CLIENTS], now, timeout;
+	char request[SERVE_REQUEST_MAX + 1];
+	const char *path = NULL;
+	long size = SERVE_DEFAULT_POOL;
+	size_t nr_clients = 0, i;
+	bool started = false;
+	pthread_t refill;
+	sigset_t mask;
+	ssize_t len;
+	int opt, fd, ret = 1;
+
+	while ((opt = getopt(argc, argv, "p:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			if (parse_long_arg(optarg, 1, LONG_MAX, &size) < 0)
+				goto usage;
+			break;
+		case 's':
+			path = optarg;
+			break;
+		default:
+usage:
+			fprintf(stderr, "usage: seedrng serve [-p seeds] [-s socket]\n");
+			return 1;
+		}
+	}
+	if (optind < argc || size < 1) {
+		fprintf(stderr, "usage: seedrng serve [-p seeds] [-s socket]\n");
+		return 1;
+	}
+	if (!path && mkdir(run_dir(), 0700) < 0 && errno != EEXIST) {
+		log_perror("Unable to create runtime directory");
+		return 1;
+	}
+	if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s%s", path ? path : run_dir(),
+			     path ? "" : "/", path ? "" : SERVE_SOCKET) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		log_perror("Unable to bind socket");
+		return 1;
+	}
+	fds[0].fd = fds[1].fd = -1;
+
+	pool.size = size;
+	pool.seed_len = determine_optimal_seed_len();
+	if (pool.size > SIZE_MAX / pool.seed_len ||
+	    !(pool.seeds = calloc(pool.size, pool.seed_len)) ||
+	    !(pool.batch = calloc(SERVE_BATCH, pool.seed_len))) {
+		log_perror("Unable to allocate seed pool");
+		goto out;
+	}
+	if (mlock(pool.seeds, pool.size * pool.seed_len) < 0 || mlock(pool.batch, SERVE_BATCH * pool.seed_len) < 0)
+		log_perror("Unable to lock seed pool in memory");
+	clock_gettime(CLOCK_MONOTONIC, &pool.start);
+	clock_gettime(CLOCK_REALTIME, &pool.realtime);
+	clock_gettime(CLOCK_BOOTTIME, &pool.boottime);
+
+	/* Blocked before the refill thread starts, so that it inherits the mask. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGINT);
+	fds[1].fd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (fds[1].fd < 0 || sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+		log_perror("Unable to watch for termination");
+		goto out;
+	}
+	/* Clients that hang up early must not take the server down. */
+	signal(SIGPIPE, SIG_IGN);
+
+	fds[0].fd = serve_bind(&addr);
+	if (fds[0].fd < 0) {
+		log_perror(errno == EADDRINUSE ? "Another server is running" : "Unable to bind socket");
+		goto out;
+	}
+	if (pthread_create(&refill, NULL, seed_pool_refill, &pool)) {
+		log_msg(LOG_LEVEL_ERR, "Unable to start refill thread");
+		goto out;
+	}
+	started = true;
+	log_msg(LOG_LEVEL_INFO, "Serving %zu-bit seeds from a pool of %zu on %s", pool.seed_len * 8, pool.size,
+		addr.sun_path);
+
+	/*
+	 * Requests are read without blocking, so that a client that connects
+	 * and sends nothing only holds up its own slot until its deadline.
+	 */
+	fds[1].events = POLLIN;
+	for (;;) {
+		fds[0].events = nr_clients < SERVE_MAX_CLIENTS ? POLLIN : 0;
+		now = serve_now_ms();
+		timeout = -1;
+		for (i = 0; i < nr_clients; ++i) {
+			if (timeout < 0 || deadlines[i] - now < timeout)
+				timeout = deadlines[i] > now ? deadlines[i] - now : 0;
+		}
+		if (poll(fds, 2 + nr_clients, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_perror("Unable to wait for clients");
+			goto out;
+		}
+		if (fds[1].revents && read(fds[1].fd, &si, sizeof(si)) == sizeof(si))
+			break;
+		now = serve_now_ms();
+		for (i = 0; i < nr_clients; ++i) {
+			len = -1;
+			if (fds[2 + i].revents) {
+				len = read(fds[2 + i].fd, request, SERVE_REQUEST_MAX);
+				if (len < 0 && errno == EAGAIN)
+					continue;
+			} else if (deadlines[i] > now)
+				continue;
+			if (len > 0) {
+				request[len] = '\0';
+				if (serve_request(&pool, fds[2 + i].fd, request) < 0) {
+					log_msg(LOG_LEVEL_ERR, "Seed pool ran dry and cannot be refilled");
+					goto out;
+				}
+			}
+			close(fds[2 + i].fd);
+			--nr_clients;
+			fds[2 + i] = fds[2 + nr_clients];
+			deadlines[i--] = deadlines[nr_clients];
+		}
+		if (fds[0].revents && (fd = accept(fds[0].fd, NULL, NULL)) >= 0) {
+			if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+				close(fd);
+				continue;
+			}
+			fds[2 + nr_clients].fd = fd;
+			fds[2 + nr_clients].events = POLLIN;
+			deadlines[nr_clients++] = now + SERVE_TIMEOUT_MS;
+		}
+	}
+	log_msg(LOG_LEVEL_INFO, "Served %llu seeds, pool ran dry %llu times",
+		(unsigned long long)pool.served, (unsigned long long)pool.dry);
+	ret = 0;
+
+out:
+	for (i = 0; i < nr_clients; ++i)
+		close(fds[2 + i].fd);
+	if (started) {
+		pthread_mutex_lock(&pool.lock);
+		pool.stop = true;
+		pthread_cond_signal(&pool.low);
+		pthread_mutex_unlock(&pool.lock);
+		pthread_join(refill, NULL);
+	}
+	if (fds[0].fd >= 0) {
+		close(fds[0].fd);
+		unlink(addr.sun_path);
+	}
+	if (fds[1].fd >= 0)
+		close(fds[1].fd);
+	if (pool.seeds)
+		memset(pool.seeds, 0, pool.size * pool.seed_len);
+	free(pool.seeds);
+	free(pool.batch);
+	return ret;
+}
+#endif
+
+enum history_params {
+	HISTORY_VERSION  = 2,
+	HISTORY_CAPACITY = 1024,
+	HISTORY_PHASES   = 16,	/* room for phases added later */
+	HISTORY_BATCH    = 64,
+	HISTORY_BUCKETS  = 128	/* quarter octaves of a microsecond */
+};
+
+enum history_flags {
+	HISTORY_CREDITABLE  = 1 << 0,
+	HISTORY_SKIP_CREDIT = 1 << 1
+};
+
+struct history_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t count;
+	uint32_t next;
+};
+
+struct history_record {
+	uint8_t boot_id[16];
+	int64_t realtime;
+	uint32_t phase_us[HISTORY_PHASES];
+	uint32_t total_us;
+	uint32_t seeded_bytes;
+	uint32_t new_seed_len;
+	uint32_t flags;
+	uint32_t exit_status;
+	uint32_t ready_seen_us;	/* since boot, 0 if not seen ready */
+};
+
+_Static_assert((int)NR_PHASES <= (int)HISTORY_PHASES, "history records have no room for every phase");
+
+static const char history_magic[8] = "SRNGHIST";
+
+static uint32_t ns_to_us(uint64_t ns)
+{
+	return ns / 1000 > UINT32_MAX ? UINT32_MAX : ns / 1000;
+}
+
+/*
+ * Appends one fixed size record to the bounded ring in HISTORY_FILE.
+ * The history is advisory, so it is neither synced nor allowed to fail
+ * the run.
+ */
+static int history_append(int dfd, const struct history_record *rec)
+{
+	struct history_header hdr;
+	ssize_t len;
+	int fd, ret = 0;
+
+	fd = openat(dfd, HISTORY_FILE, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return -1;
+	len = pread(fd, &hdr, sizeof(hdr), 0);
+	if (len != sizeof(hdr) || memcmp(hdr.magic, history_magic, sizeof(hdr.magic)) ||
+	    hdr.version != HISTORY_VERSION || !hdr.capacity || hdr.next >= hdr.capacity) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, history_magic, sizeof(hdr.magic));
+		hdr.version = HISTORY_VERSION;
+		hdr.capacity = HISTORY_CAPACITY;
+		if (ftruncate(fd, 0) < 0)
+			ret = -errno;
+	}
+	if (!ret && pwrite(fd, rec, sizeof(*rec), sizeof(hdr) + (off_t)hdr.next * sizeof(*rec)) != sizeof(*rec))
+		ret = -errno;
+	if (!ret) {
+		hdr.next = (hdr.next + 1) % hdr.capacity;
+		if (hdr.count < hdr.capacity)
+			++hdr.count;
+		if (pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			ret = -errno;
+	}
+	close(fd);
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+struct history_stat {
+	uint32_t buckets[HISTORY_BUCKETS];
+	uint32_t max;
+	uint32_t count[2];
+	uint64_t sum[2];	/* older and newer half, for the trend */
+};
+
+static unsigned int history_bucket(uint32_t us)
+{
+	unsigned int octave = 0, quarter;
+
+	if (us < 4)
+		return us;
+	while (us >> (octave + 1) >= 4)
+		++octave;
+	quarter = (us >> octave) & 3;
+	return 4 + octave * 4 + quarter;
+}
+
+/* Lower bound of the values counted in a bucket. */
+static uint32_t history_bucket_floor(unsigned int bucket)
+{
+	if (bucket < 4)
+		return bucket;
+	return (uint32_t)(4 + (bucket - 4) % 4) << ((bucket - 4) / 4);
+}
+
+static void history_stat_add(struct history_stat *stat, uint32_t us, bool newer)
+{
+	++stat->buckets[history_bucket(us)];
+	if (us > stat->max)
+		stat->max = us;
+	++stat->count[newer];
+	stat->sum[newer] += us;
+}
+
+static uint32_t history_percentile(const struct history_stat *stat, uint32_t count, unsigned int pct)
+{
+	uint64_t seen = 0, rank = ((uint64_t)count * pct + 99) / 100;
+	unsigned int i;
+
+	for (i = 0; i < HISTORY_BUCKETS; ++i) {
+		seen += stat->buckets[i];
+		if (seen >= rank && seen)
+			return history_bucket_floor(i);
+	}
+	return stat->max;
+}
+
+static void history_print_stat(const char *name, const struct history_stat *stat)
+{
+	uint32_t older = stat->count[0], newer = stat->count[1], count = older + newer;
+	double old_mean = older ? (double)stat->sum[0] / older : 0;
+	double new_mean = newer ? (double)stat->sum[1] / newer : 0;
+
+	printf("  %-10s %10u %10u %10u %10u %+9.1f%%\n", name,
+	       history_percentile(stat, count, 50), history_percentile(stat, count, 90),
+	       history_percentile(stat, count, 99), stat->max,
+	       old_mean > 0 && newer ? (new_mean - old_mean) * 100 / old_mean : 0.0);
+}
+
+/*
+ * Failures of the inputs and outputs beyond the seed files, by bit of the
+ * run's status.  The history keeps them apart, but an exit status only
+ * has room for bit 7, so exit_status() folds them into it.
+ */
+static const char *const run_failure_names[] = {
+	[8]  = "spool",
+	[9]  = "sources",
+	[10] = "fanout",
+	[11] = "jitter"
+};
+
+static int exit_status(int program_ret)
+{
+	return (program_ret & 0x7f) | (program_ret >> 7 ? 1 << 7 : 0);
+}
+
+static int cmd_history(int argc __attribute__((unused)), char *argv[] __attribute__((unused)))
+{
+	static struct history_stat stats[NR_PHASES + 1], ready_seen;
+	struct history_record recs[HISTORY_BATCH];
+	struct history_header hdr;
+	uint32_t i, idx, n, creditable = 0, failed = 0, boots = 0, last_status = 0;
+	uint8_t last_boot[16] = { 0 };
+	int64_t first = 0, last = 0;
+	int dfd, fd, p;
+	ssize_t len;
+	bool newer;
+
+	dfd = open(seed_dir(), O_DIRECTORY | O_RDONLY);
+	fd = dfd < 0 ? -1 : openat(dfd, HISTORY_FILE, O_RDONLY);
+	if (fd < 0 || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, history_magic, sizeof(hdr.magic)) || hdr.version != HISTORY_VERSION ||
+	    !hdr.capacity || hdr.count > hdr.capacity || hdr.next >= hdr.capacity) {
+		fprintf(stderr, "No usable run history in %s\n", seed_dir());
+		if (fd >= 0)
+			close(fd);
+		if (dfd >= 0)
+			close(dfd);
+		return 1;
+	}
+	close(dfd);
+
+	/* Oldest to newest, HISTORY_BATCH records per read. */
+	for (i = 0; i < hdr.count; i += n) {
+		idx = (hdr.count < hdr.capacity ? i : (hdr.next + i) % hdr.capacity);
+		n = hdr.count - i;
+		if (n > HISTORY_BATCH)
+			n = HISTORY_BATCH;
+		if (n > hdr.capacity - idx)
+			n = hdr.capacity - idx;
+		len = pread(fd, recs, n * sizeof(*recs), sizeof(hdr) + (off_t)idx * sizeof(*recs));
+		if (len != (ssize_t)(n * sizeof(*recs))) {
+			perror("Unable to read run history");
+			close(fd);
+			return 1;
+		}
+		for (idx = 0; idx < n; ++idx) {
+			const struct history_record *rec = &recs[idx];
+
+			newer = i + idx >= hdr.count / 2;
+			for (p = 0; p < NR_PHASES; ++p)
+				history_stat_add(&stats[p], rec->phase_us[p], newer);
+			history_stat_add(&stats[NR_PHASES], rec->total_us, newer);
+			creditable += !!(rec->flags & HISTORY_CREDITABLE);
+			failed += !!rec->exit_status;
+			last_status = rec->exit_status;
+			if (memcmp(last_boot, rec->boot_id, sizeof(last_boot))) {
+				memcpy(last_boot, rec->boot_id, sizeof(last_boot));
+				++boots;
+				/* Later runs of a boot find the CRNG long ready. */
+				if (rec->ready_seen_us)
+					history_stat_add(&ready_seen, rec->ready_seen_us, newer);
+			}
+			if (!first)
+				first = rec->realtime;
+			last = rec->realtime;
+		}
+	}
+	close(fd);
 
-	umask(0077);
-	if (getuid()) {
-		errno = EACCES;
-		perror("This program requires root");
-		return 1;
+	printf("%u runs over %u boots in %.1f days, %u with creditable new seeds, %u with errors\n",
+	       hdr.count, boots, (last - first) / 86400.0, creditable, failed);
+	if (!hdr.count)
+		return 0;
+	printf("Last run exited with %d", exit_status(last_status));
+	for (p = 8; p < (int)ARRAY_SIZE(run_failure_names); ++p) {
+		if (last_status & 1U << p)
+			printf(", %s failed", run_failure_names[p]);
 	}
+	printf("\n");
+	printf("  %-10s %10s %10s %10s %10s %10s\n", "phase (us)", "p50", "p90", "p99", "max", "trend");
+	for (p = 0; p < NR_PHASES; ++p)
+		history_print_stat(phase_names[p], &stats[p]);
+	history_print_stat("total", &stats[NR_PHASES]);
+	if (ready_seen.count[0] + ready_seen.count[1])
+		history_print_stat("ready-by", &ready_seen);
+	return 0;
+}
+
+#ifndef SEEDRNG_NOLIBC
+enum bench_params {
+	BENCH_RUNS          = 15,
+	BENCH_BYTES         = 1 << 20,
+	BENCH_HASHES        = 10000,
+	BENCH_SERVICE_BYTES = 1 << 16,
+	BENCH_SERVICE_WRITE = 4096
+};
+
+enum bench_competitor {
+	COMPETE_NONE,
+	COMPETE_NORMAL,
+	COMPETE_BACKGROUND
+};
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double median_us(uint64_t *ns)
+{
+	qsort(ns, BENCH_RUNS, sizeof(*ns), compare_u64);
+	return ns[BENCH_RUNS / 2] / 1e3;
+}
+
+/*
+ * Median time in ns to hash the fields of a run with a len byte seed,
+ * either through the incremental API or in one shot.
+ */
+static double bench_blake2s(size_t len, bool oneshot)
+{
+	static const char prefix[] = "SeedRNG v1 Old+New Prefix";
+	struct timespec realtime, boottime;
+	uint8_t seed[MAX_SEED_LEN] = { 0 };
+	const struct iovec fields[] = {
+		{ .iov_base = (void *)prefix, .iov_len = sizeof(prefix) - 1 },
+		{ .iov_base = &realtime, .iov_len = sizeof(realtime) },
+		{ .iov_base = &boottime, .iov_len = sizeof(boottime) },
+		{ .iov_base = &len, .iov_len = sizeof(len) },
+		{ .iov_base = seed, .iov_len = len }
+	};
+	struct blake2s_state hash;
+	uint64_t ns[BENCH_RUNS], start;
+	int i, j;
 
-	blake2s_init(&hash, BLAKE2S_HASH_LEN);
-	blake2s_update(&hash, seedrng_prefix, strlen(seedrng_prefix));
 	clock_gettime(CLOCK_REALTIME, &realtime);
 	clock_gettime(CLOCK_BOOTTIME, &boottime);
-	blake2s_update(&hash, &realtime, sizeof(realtime));
-	blake2s_update(&hash, &boottime, sizeof(boottime));
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		start = bench_now();
+		for (j = 0; j < BENCH_HASHES; ++j) {
+			if (oneshot)
+				blake2sv(seed, BLAKE2S_HASH_LEN, NULL, 0, fields, ARRAY_SIZE(fields));
+			else {
+				blake2s_init(&hash, BLAKE2S_HASH_LEN);
+				blake2s_update(&hash, prefix, strlen(prefix));
+				blake2s_update(&hash, &realtime, sizeof(realtime));
+				blake2s_update(&hash, &boottime, sizeof(boottime));
+				blake2s_update(&hash, &len, sizeof(len));
+				blake2s_update(&hash, seed, len);
+				blake2s_final(&hash, seed);
+			}
+		}
+		ns[i] = bench_now() - start;
+	}
+	return median_us(ns) * 1e3 / BENCH_HASHES;
+}
 
-	if (mkdir(SEED_DIR, 0700) < 0 && errno != EEXIST) {
-		perror("Unable to create seed directory");
+#ifdef BLAKE2S_VECTOR
+/*
+ * Throughput in MiB/s of one compression kernel over buf, which ends
+ * with a final block, leaving the resulting chaining value in h.
+ */
+static double bench_compress(void (*compress)(struct blake2s_state *, const uint8_t *, size_t, const uint32_t),
+			     const uint8_t *buf, uint32_t h[8])
+{
+	struct blake2s_state state;
+	uint64_t start;
+	double elapsed;
+
+	blake2s_init(&state, BLAKE2S_HASH_LEN);
+	start = bench_now();
+	compress(&state, buf, BENCH_BYTES / BLAKE2S_BLOCK_LEN - 1, BLAKE2S_BLOCK_LEN);
+	blake2s_set_lastblock(&state);
+	compress(&state, buf + BENCH_BYTES - BLAKE2S_BLOCK_LEN, 1, BLAKE2S_BLOCK_LEN / 2);
+	elapsed = (bench_now() - start) / 1e9;
+	memcpy(h, state.h, sizeof(state.h));
+	return BENCH_BYTES / (1024.0 * 1024.0) / elapsed;
+}
+#endif
+
+static void print_bench_blake2s(size_t len)
+{
+	static const char *const apis[] = { "update", "one-shot" };
+	char label[64];
+	int i;
+
+	for (i = 0; i < (int)ARRAY_SIZE(apis); ++i) {
+		snprintf(label, sizeof(label), "BLAKE2s %zu byte run, %s", len, apis[i]);
+		printf("%-32s %10.1f ns\n", label, bench_blake2s(len, i));
+	}
+}
+
+/* Median latency of rewriting a seed sized scratch file and syncing it. */
+static double bench_sync(int dfd, enum sync_method method, size_t len)
+{
+	enum sync_method saved = config.sync;
+	uint8_t seed[MAX_SEED_LEN] = { 0 };
+	uint64_t ns[BENCH_RUNS], start;
+	int fd, i;
+
+	fd = openat(dfd, BENCH_SEED, O_WRONLY | O_CREAT | O_TRUNC, 0400);
+	if (fd < 0)
+		return -1;
+	config.sync = method;
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		if (pwrite(fd, seed, len, 0) != (ssize_t)len)
+			break;
+		start = bench_now();
+		if (sync_file(fd) < 0)
+			break;
+		ns[i] = bench_now() - start;
+	}
+	config.sync = saved;
+	close(fd);
+	return i == BENCH_RUNS ? median_us(ns) : -1;
+}
+
+/* Median cost of persisting a seed through a new file and a rename. */
+static double bench_rename(int dfd, size_t len)
+{
+	uint8_t seed[MAX_SEED_LEN] = { 0 };
+	uint64_t ns[BENCH_RUNS], start;
+	int fd, i;
+
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		start = bench_now();
+		fd = openat(dfd, BENCH_SEED, O_WRONLY | O_CREAT | O_TRUNC, 0400);
+		if (fd < 0)
+			break;
+		if (write_full(fd, seed, len) != (ssize_t)len || sync_file(fd) < 0 ||
+		    renameat(dfd, BENCH_SEED, dfd, BENCH_SEED ".renamed") < 0) {
+			close(fd);
+			break;
+		}
+		close(fd);
+		ns[i] = bench_now() - start;
+	}
+	unlinkat(dfd, BENCH_SEED ".renamed", 0);
+	return i == BENCH_RUNS ? median_us(ns) : -1;
+}
+
+/* Median cost of overwriting an existing, preallocated file in place. */
+static double bench_inplace(int dfd, size_t len)
+{
+	uint8_t seed[MAX_SEED_LEN] = { 0 };
+	uint64_t ns[BENCH_RUNS], start;
+	int fd, i;
+
+	fd = openat(dfd, BENCH_SEED, O_WRONLY | O_CREAT | O_TRUNC, 0400);
+	if (fd < 0 || write_full(fd, seed, len) != (ssize_t)len || fsync(fd) < 0) {
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		start = bench_now();
+		if (pwrite(fd, seed, len, 0) != (ssize_t)len || fdatasync(fd) < 0)
+			break;
+		ns[i] = bench_now() - start;
+	}
+	close(fd);
+	return i == BENCH_RUNS ? median_us(ns) : -1;
+}
+
+/*
+ * Median latency of a stand-in for another boot service, one round of
+ * hashing plus a small synced write, while a forked competitor persists
+ * seeds in a tight loop at normal or background priority.  Everything
+ * is pinned to the lowest CPU we may run on, so the CPU policy counts as
+ * well as the I/O class.
+ */
+static double bench_interference(int dfd, size_t len, enum bench_competitor competitor)
+{
+	static uint8_t work[BENCH_SERVICE_BYTES];
+	unsigned long saved_mask[16], pin_mask[16] = { 0 };
+	const size_t bits = 8 * sizeof(saved_mask[0]);
+	uint64_t ns[BENCH_RUNS], start;
+	uint8_t out[BLAKE2S_HASH_LEN];
+	struct blake2s_state hash;
+	pid_t pid = -1;
+	size_t cpu;
+	int fd, i = 0;
+
+	memset(saved_mask, 0, sizeof(saved_mask));
+	if (syscall(SYS_sched_getaffinity, 0, sizeof(saved_mask), saved_mask) < 0)
+		return -1;
+	for (cpu = 0; cpu < ARRAY_SIZE(saved_mask) * bits && !(saved_mask[cpu / bits] & 1UL << cpu % bits); ++cpu)
+		;
+	if (cpu == ARRAY_SIZE(saved_mask) * bits)
+		return -1;
+	pin_mask[cpu / bits] = 1UL << cpu % bits;
+	if (syscall(SYS_sched_setaffinity, 0, sizeof(pin_mask), pin_mask) < 0)
+		return -1;
+	fd = openat(dfd, BENCH_SEED ".service", O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		goto out;
+	if (competitor != COMPETE_NONE) {
+		pid = fork();
+		if (pid < 0)
+			goto out;
+		if (!pid) {
+			set_background(competitor == COMPETE_BACKGROUND);
+			for (;;) {
+				blake2s_init(&hash, BLAKE2S_HASH_LEN);
+				blake2s_update(&hash, work, sizeof(work));
+				blake2s_final(&hash, out);
+				bench_rename(dfd, len);
+			}
+		}
+	}
+	for (i = 0; i < BENCH_RUNS; ++i) {
+		start = bench_now();
+		blake2s_init(&hash, BLAKE2S_HASH_LEN);
+		blake2s_update(&hash, work, sizeof(work));
+		blake2s_final(&hash, out);
+		if (pwrite(fd, work, BENCH_SERVICE_WRITE, 0) != BENCH_SERVICE_WRITE || fdatasync(fd) < 0)
+			break;
+		ns[i] = bench_now() - start;
+	}
+
+out:
+	/* The competitor dies mid-loop, leaving its seeds behind. */
+	if (pid > 0) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		unlinkat(dfd, BENCH_SEED, 0);
+		unlinkat(dfd, BENCH_SEED ".renamed", 0);
+	}
+	if (fd >= 0)
+		close(fd);
+	unlinkat(dfd, BENCH_SEED ".service", 0);
+	syscall(SYS_sched_setaffinity, 0, sizeof(saved_mask), saved_mask);
+	return fd >= 0 && i == BENCH_RUNS ? median_us(ns) : -1;
+}
+
+static int cmd_bench(int argc, char *argv[])
+{
+	static uint8_t buf[BENCH_BYTES];
+	static const char *const competitor_labels[] = {
+		[COMPETE_NONE]       = "service alone",
+		[COMPETE_NORMAL]     = "service + seedrng",
+		[COMPETE_BACKGROUND] = "service + background seedrng"
+	};
+	double sync_us[NR_SYNC_METHODS], service_us[ARRAY_SIZE(competitor_labels)], rename_us, inplace_us, elapsed;
+	enum sync_method best = SYNC_FSYNC;
+	enum priority_policy priority = PRIORITY_NONE;
+	struct blake2s_state hash;
+	struct seed_hash tree;
+	uint8_t out[BLAKE2S_HASH_LEN];
+#ifdef BLAKE2S_VECTOR
+	uint32_t h[2][8];
+#endif
+	size_t len = determine_optimal_seed_len(), off, n;
+	bool write_config = false;
+	char label[64];
+	uint64_t start;
+	int opt, dfd, fd, i, ret = 0;
+
+	while ((opt = getopt(argc, argv, "w")) != -1) {
+		switch (opt) {
+		case 'w':
+			write_config = true;
+			break;
+		default:
+			fprintf(stderr, "usage: seedrng bench [-w]\n");
+			return 1;
+		}
+	}
+
+	start = bench_now();
+	for (off = 0; off < sizeof(buf); off += n) {
+		n = len < sizeof(buf) - off ? len : sizeof(buf) - off;
+		if (getrandom_full(buf + off, n, GRND_INSECURE) != (ssize_t)n) {
+			perror("Unable to read from getrandom");
+			return 1;
+		}
+	}
+	elapsed = (bench_now() - start) / 1e9;
+	snprintf(label, sizeof(label), "getrandom, %zu byte reads", len);
+	printf("%-32s %10.1f MiB/s\n", label, 1 / elapsed);
+
+	start = bench_now();
+	blake2s_init(&hash, BLAKE2S_HASH_LEN);
+	blake2s_update(&hash, buf, sizeof(buf));
+	blake2s_final(&hash, out);
+	elapsed = (bench_now() - start) / 1e9;
+	printf("%-32s %10.1f MiB/s\n", "BLAKE2s", 1 / elapsed);
+	start = bench_now();
+	seed_hash_init(&tree, HASH_BLAKE2SP);
+	seed_hash_update(&tree, buf, sizeof(buf));
+	seed_hash_final(&tree, out);
+	elapsed = (bench_now() - start) / 1e9;
+	printf("%-32s %10.1f MiB/s\n", "BLAKE2sp", 1 / elapsed);
+#ifdef BLAKE2S_VECTOR
+	printf("%-32s %10.1f MiB/s\n", "BLAKE2s scalar kernel", bench_compress(blake2s_compress_generic, buf, h[0]));
+	printf("%-32s %10.1f MiB/s\n", "BLAKE2s vector kernel", bench_compress(blake2s_compress_vector, buf, h[1]));
+	if (memcmp(h[0], h[1], sizeof(h[0]))) {
+		fprintf(stderr, "BLAKE2s vector kernel disagrees with the scalar one\n");
 		return 1;
 	}
+#endif
+	print_bench_blake2s(len);
+	if (len != MAX_SEED_LEN)
+		print_bench_blake2s(MAX_SEED_LEN);
 
-	dfd = open(SEED_DIR, O_DIRECTORY | O_RDONLY);
+	if (mkdir(seed_dir(), 0700) < 0 && errno != EEXIST) {
+		perror("Unable to create seed directory");
+		return 1;
+	}
+	dfd = open(seed_dir(), O_DIRECTORY | O_RDONLY);
 	if (dfd < 0 || flock(dfd, LOCK_EX) < 0) {
 		perror("Unable to lock seed directory");
+		if (dfd >= 0)
+			close(dfd);
+		return 1;
+	}
+	for (i = 0; i < NR_SYNC_METHODS; ++i) {
+		sync_us[i] = bench_sync(dfd, i, len);
+		if (sync_us[i] < 0) {
+			perror("Unable to benchmark sync");
+			ret = 1;
+			goto out;
+		}
+		snprintf(label, sizeof(label), "%s in seed directory", sync_method_names[i]);
+		printf("%-32s %10.1f us\n", label, sync_us[i]);
+		/*
+		 * Only leave plain fsync for a clear, not a noisy, win.  syncfs
+		 * is timed for comparison only: it flushes the whole file system,
+		 * and reports writeback errors of our file only since Linux 5.8.
+		 */
+		if (i != SYNC_SYNCFS && sync_us[i] < sync_us[best] * 0.9)
+			best = i;
+	}
+	config.sync = best;
+	rename_us = bench_rename(dfd, len);
+	inplace_us = bench_inplace(dfd, len);
+	if (rename_us < 0 || inplace_us < 0) {
+		perror("Unable to benchmark seed writes");
+		ret = 1;
+		goto out;
+	}
+	snprintf(label, sizeof(label), "new file + %s + rename", sync_method_names[best]);
+	printf("%-32s %10.1f us\n", label, rename_us);
+	printf("%-32s %10.1f us\n", "in-place pwrite + fdatasync", inplace_us);
+
+	for (i = 0; i < (int)ARRAY_SIZE(competitor_labels); ++i) {
+		service_us[i] = bench_interference(dfd, len, i);
+		if (service_us[i] < 0) {
+			perror("Unable to benchmark interference");
+			ret = 1;
+			goto out;
+		}
+		printf("%-32s %10.1f us\n", competitor_labels[i], service_us[i]);
+	}
+	/* Background persistence only pays off if others measurably gain. */
+	if (service_us[COMPETE_BACKGROUND] < service_us[COMPETE_NORMAL] * 0.9)
+		priority = PRIORITY_BOOT;
+
+	/*
+	 * Both candidate sync methods flush the data and report its errors
+	 * before we go on to credit it, so the faster one is safe.  A new
+	 * seed must still be created under a non-creditable name and renamed
+	 * once durable, so in-place writes are only reported for comparison.
+	 */
+	printf("Recommended configuration:\n  sync = %s\n  priority = %s\n",
+	       sync_method_names[best], priority_policy_names[priority]);
+	if (write_config) {
+		fd = openat(dfd, CONFIG_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+		if (fd < 0 || dprintf(fd, "# written by seedrng bench\nsync = %s\npriority = %s\n",
+				      sync_method_names[best], priority_policy_names[priority]) < 0 || fsync(fd) < 0) {
+			perror("Unable to write configuration file");
+			ret = 1;
+		} else
+			printf("Wrote %s/%s\n", seed_dir(), CONFIG_FILE);
+		if (fd >= 0)
+			close(fd);
+	}
+
+out:
+	unlinkat(dfd, BENCH_SEED, 0);
+	close(dfd);
+	return ret;
+}
+#endif
+
+/*
+ * One run: seeds the RNG from everything available and saves a new seed
+ * for the next one.  Returns a bit mask of the steps that failed.
+ */
+static int run_seedrng(bool timings, bool resources, bool handoff)
+{
+	/* Versioned with the construction; old seeds are input to either. */
+	static const char *const seedrng_prefixes[NR_HASH_BACKENDS] = {
+		[HASH_BLAKE2S]  = "SeedRNG v1 Old+New Prefix",
+		[HASH_BLAKE2SP] = "SeedRNG v2 BLAKE2sp Old+New Prefix"
+	};
+	static const char seedrng_failure[] = "SeedRNG v1 No New Seed Failure";
+	static const char seedrng_fanout[] = "SeedRNG v1 Fan-out Key";
+	const char *new_seed_name = NON_CREDITABLE_SEED;
+	int fd = -1, dfd = -1, program_ret = 0;
+	uint8_t new_seed[MAX_SEED_LEN], fanout_key[BLAKE2S_KEY_LEN];
+	size_t new_seed_len = 0;
+	bool new_seed_creditable = false, read_only = false, deferred = false, committed = false;
+	struct tombstone tombs[2] = { { 0 } };
+	struct timespec realtime = { 0 }, boottime = { 0 };
+	struct seed_hash hash, chain, fanout_hash;
+	struct phase_timer timer;
+	struct phase_usage usage;
+	struct history_record rec = { .ready_seen_us = 0 };
+	size_t i, seeded = 0;
+	unsigned int jitter_ms;
+	uint64_t now;
+
+	phase_start(&timer, resources ? &usage : NULL);
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_BOOTTIME, &boottime);
+
+	if (mkdir(seed_dir(), 0700) < 0 && errno != EEXIST && errno != EROFS) {
+		log_perror("Unable to create seed directory");
+		return 1;
+	}
+
+	/*
+	 * A read-only seed directory, or a missing one on a read-only file
+	 * system, defers persistence: old seeds are used without credit and
+	 * left in place, and the new seed is staged in RUN_DIR.
+	 */
+	dfd = open(seed_dir(), O_DIRECTORY | O_RDONLY);
+	if (dfd < 0 && errno == ENOENT)
+		read_only = true;
+	else if (dfd < 0 || flock(dfd, LOCK_EX) < 0) {
+		log_perror("Unable to lock seed directory");
 		program_ret = 1;
 		goto out;
+	} else {
+		read_config(dfd);
+		read_only = is_read_only(dfd);
+	}
+	/*
+	 * A seed handed over by the initramfs, or staged while read-only,
+	 * already carries everything this run would gather, so committing it
+	 * is all that is left to do.
+	 */
+	if (!read_only && !handoff && !dry_run) {
+		switch (commit_pending_at(dfd)) {
+		case 1:
+			committed = true;
+			phase_end(&timer, PHASE_LOCK);
+			goto out;
+		case -1:
+			log_perror("Unable to commit pending seed");
+			program_ret |= 1 << 4;
+			break;
+		}
 	}
+	deferred = read_only || handoff;
+	/* The configuration picks the hash, so the chain starts here. */
+	seed_hash_init(&hash, config.hash);
+	seed_hash_update(&hash, seedrng_prefixes[config.hash], strlen(seedrng_prefixes[config.hash]));
+	seed_hash_update(&hash, &realtime, sizeof(realtime));
+	seed_hash_update(&hash, &boottime, sizeof(boottime));
+	if (read_only)
+		log_msg(LOG_LEVEL_INFO, "%s is read-only, deferring the new seed to %s", seed_dir(), run_dir());
+	/* At shutdown, only the new seed matters; at boot, only the old. */
+	if (config.priority == PRIORITY_SHUTDOWN)
+		set_background(true);
+	phase_end(&timer, PHASE_LOCK);
 
-	if (seed_from_file_if_exists(NON_CREDITABLE_SEED, dfd, false, &hash) < 0)
+	if (dfd >= 0 && seed_from_file_if_exists(NON_CREDITABLE_SEED, dfd, false, &hash, &seeded,
+						 read_only ? &tombs[0] : NULL) < 0)
 		program_ret |= 1 << 1;
-	if (seed_from_file_if_exists(CREDITABLE_SEED, dfd, !skip_credit(), &hash) < 0)
+	if (dfd >= 0 && seed_from_file_if_exists(CREDITABLE_SEED, dfd, !read_only && !skip_credit(), &hash, &seeded,
+						 read_only ? &tombs[1] : NULL) < 0)
 		program_ret |= 1 << 2;
+	phase_end(&timer, PHASE_LOAD);
+	/* Spooled fragments cannot be consumed yet, so leave them for later. */
+	if (!read_only && seed_from_spool_if_exists(dfd, !skip_credit(), &hash, &seeded) < 0)
+		program_ret |= 1 << 8;
+	phase_end(&timer, PHASE_SPOOL);
+	seed_from_host_data(&hash);
+	if (seed_from_aux_sources(&hash, &seeded) < 0)
+		program_ret |= 1 << 9;
+	phase_end(&timer, PHASE_SOURCES);
+	if (!seeded && (jitter_ms = jitter_budget_ms()) && seed_from_cpu_jitter(jitter_ms, &hash, &seeded) < 0) {
+		log_perror("Unable to seed from CPU jitter");
+		program_ret |= 1 << 11;
+	}
+	phase_end(&timer, PHASE_JITTER);
+	if (config.priority == PRIORITY_SHUTDOWN)
+		set_background(false);
 
 	new_seed_len = determine_optimal_seed_len();
 	if (read_new_seed(new_seed, new_seed_len, &new_seed_creditable) < 0) {
-		perror("Unable to read new seed");
+		log_perror("Unable to read new seed");
 		new_seed_len = BLAKE2S_HASH_LEN;
 		strncpy((char *)new_seed, seedrng_failure, new_seed_len);
 		program_ret |= 1 << 3;
 	}
-	blake2s_update(&hash, &new_seed_len, sizeof(new_seed_len));
-	blake2s_update(&hash, new_seed, new_seed_len);
-	blake2s_final(&hash, new_seed + new_seed_len - BLAKE2S_HASH_LEN);
+	/*
+	 * By now the old seeds have been credited, if they could be.  This
+	 * is when the run first saw the CRNG ready, not when it became ready,
+	 * so it mostly tracks when the run was started.  Past about 71
+	 * minutes after boot it does not fit and 0 is kept instead.
+	 */
+	if (new_seed_creditable && (now = boottime_ns()) / 1000 <= UINT32_MAX)
+		rec.ready_seen_us = now / 1000;
+	phase_end(&timer, PHASE_GENERATE);
+	seed_hash_update(&hash, &new_seed_len, sizeof(new_seed_len));
+	seed_hash_update(&hash, new_seed, new_seed_len);
+	if (config.nr_fanout) {
+		fanout_hash = hash;
+		seed_hash_update(&fanout_hash, seedrng_fanout, strlen(seedrng_fanout));
+		seed_hash_final(&fanout_hash, fanout_key);
+	}
+	chain = hash;
+	TRACE1(hash_final__entry, new_seed_len);
+	seed_hash_final(&hash, new_seed + new_seed_len - BLAKE2S_HASH_LEN);
+	TRACE1(hash_final__return, new_seed_len);
+	phase_end(&timer, PHASE_HASH);
+	if (config.priority == PRIORITY_BOOT)
+		set_background(true);
 
-	printf("Saving %zu bits of %s seed for next boot\n", new_seed_len * 8, new_seed_creditable ? "creditable" : "non-creditable");
-	fd = openat(dfd, NON_CREDITABLE_SEED, O_WRONLY | O_CREAT | O_TRUNC, 0400);
+	if (deferred) {
+		log_msg(LOG_LEVEL_INFO, "Staging %zu bits of %s seed until %s", new_seed_len * 8,
+			new_seed_creditable ? "creditable" : "non-creditable",
+			read_only ? "the seed directory is writable" : "the next run");
+		if (!dry_run && stage_pending(&chain, new_seed, new_seed_len, new_seed_creditable, tombs,
+					      ARRAY_SIZE(tombs)) < 0) {
+			log_perror("Unable to stage new seed");
+			program_ret |= 1 << 4;
+		}
+		memset(&chain, 0, sizeof(chain));
+		goto out;
+	}
+
+	/* A dry run writes a scratch file next to the seeds instead. */
+	if (dry_run)
+		new_seed_name = DRY_RUN_SEED;
+	log_msg(LOG_LEVEL_INFO, "Saving %zu bits of %s seed for next boot", new_seed_len * 8, new_seed_creditable ? "creditable" : "non-creditable");
+	TRACE2(write_seed__entry, new_seed_len, new_seed_creditable);
+	fd = openat(dfd, new_seed_name, O_WRONLY | O_CREAT | O_TRUNC, 0400);
 	if (fd < 0) {
-		perror("Unable to open seed file for writing");
+		log_perror("Unable to open seed file for writing");
+		TRACE2(write_seed__return, -1, errno);
 		program_ret |= 1 << 4;
 		goto out;
 	}
-	if (write_full(fd, new_seed, new_seed_len) != (ssize_t)new_seed_len || fsync(fd) < 0) {
-		perror("Unable to write seed file");
+	if (write_full(fd, new_seed, new_seed_len) != (ssize_t)new_seed_len) {
+		log_perror("Unable to write seed file");
+		TRACE2(write_seed__return, -1, errno);
+		program_ret |= 1 << 5;
+		goto out;
+	}
+	TRACE2(write_seed__return, 0, 0);
+	phase_end(&timer, PHASE_WRITE);
+	TRACE1(sync_seed__entry, config.sync);
+	if (sync_file(fd) < 0) {
+		log_perror("Unable to write seed file");
+		TRACE2(sync_seed__return, -1, errno);
 		program_ret |= 1 << 5;
 		goto out;
 	}
-	if (new_seed_creditable && renameat(dfd, NON_CREDITABLE_SEED, dfd, CREDITABLE_SEED) < 0) {
-		perror("Unable to make new seed creditable");
-		program_ret |= 1 << 6;
+	TRACE2(sync_seed__return, 0, 0);
+	phase_end(&timer, PHASE_SYNC);
+	if (new_seed_creditable && !dry_run) {
+		TRACE0(rename_seed__entry);
+		if (renameat(dfd, NON_CREDITABLE_SEED, dfd, CREDITABLE_SEED) < 0) {
+			log_perror("Unable to make new seed creditable");
+			TRACE2(rename_seed__return, -1, errno);
+			program_ret |= 1 << 6;
+		} else
+			TRACE2(rename_seed__return, 0, 0);
 	}
+	phase_end(&timer, PHASE_RENAME);
+	/* Without a new seed, derived seeds would only carry the old ones. */
+	if (config.nr_fanout && !(program_ret & (1 << 3)) && write_fanout(fanout_key) < 0)
+		program_ret |= 1 << 10;
+	memset(fanout_key, 0, sizeof(fanout_key));
+	phase_end(&timer, PHASE_FANOUT);
 out:
 	if (fd >= 0)
 		close(fd);
+	if (!dry_run && !deferred && !committed && dfd >= 0 && !(program_ret & 1)) {
+		read_boot_id(rec.boot_id);
+		rec.realtime = realtime.tv_sec;
+		for (i = 0; i < NR_PHASES; ++i)
+			rec.phase_us[i] = ns_to_us(timer.ns[i]);
+		rec.total_us = ns_to_us(timespec_diff_ns(&timer.start, &timer.last));
+		rec.seeded_bytes = seeded;
+		rec.new_seed_len = new_seed_len;
+		rec.flags = (new_seed_creditable ? HISTORY_CREDITABLE : 0) |
+			    (skip_credit() ? HISTORY_SKIP_CREDIT : 0);
+		rec.exit_status = program_ret;
+		history_append(dfd, &rec);
+	}
+	if (dry_run && dfd >= 0)
+		unlinkat(dfd, DRY_RUN_SEED, 0);
 	if (dfd >= 0)
 		close(dfd);
+	/* After a handoff, the next run commits the seed. */
+	if (read_only && !handoff && !dry_run && !(program_ret & (1 << 4)) && config.defer == DEFER_WATCH)
+		spawn_commit_watcher();
+	set_background(false);
+	if (timings && !(program_ret & 1))
+		print_phase_timings(&timer);
+	if (resources) {
+		if (!(program_ret & 1))
+			print_phase_usage(&usage, seeded, new_seed_len, new_seed_creditable);
+		phase_usage_stop(&usage);
+	}
 	return program_ret;
 }
+
+/*
+ * The next-boot seed kept ready by `seedrng watch -s': the chain up to
+ * the precomputed seed, and the seed file it has already been written
+ * to, held open and locked in memory.
+ */
+static struct shutdown_seed {
+	struct blake2s_state hash;
+	uint8_t seed[MAX_SEED_LEN];
+	size_t len;
+	bool creditable;
+	int dfd, fd;
+} shutdown_seed = { .dfd = -1, .fd = -1 };
+
+/*
+ * Chains the current seed files and a new seed from the kernel into a
+ * precomputed next-boot seed, and persists it the usual way: a new file
+ * under the non-creditable name, synced, then renamed.  The old files
+ * are only hashed: they have not fed the RNG yet, and still will not.
+ * The file stays open, so that shutdown only has to overwrite it.
+ */
+static int prepare_shutdown_seed(struct shutdown_seed *ss)
+{
+	static const char seedrng_shutdown[] = "SeedRNG v1 Shutdown Prefix";
+	const char *const names[] = { NON_CREDITABLE_SEED, CREDITABLE_SEED };
+	struct blake2s_state hash;
+	struct timespec realtime, boottime;
+	uint8_t old[MAX_SEED_LEN];
+	ssize_t len;
+	size_t i;
+	int fd, ret = 0;
+
+	if (ss->fd >= 0)
+		close(ss->fd);
+	if (ss->dfd >= 0)
+		close(ss->dfd);
+	ss->fd = -1;
+	ss->dfd = open(seed_dir(), O_DIRECTORY | O_RDONLY | O_CLOEXEC);
+	if (ss->dfd < 0 || flock(ss->dfd, LOCK_EX) < 0)
+		return -1;
+	read_config(ss->dfd);
+	if (is_read_only(ss->dfd)) {
+		ret = -EROFS;
+		goto out;
+	}
+
+	blake2s_init(&ss->hash, BLAKE2S_HASH_LEN);
+	blake2s_update(&ss->hash, seedrng_shutdown, strlen(seedrng_shutdown));
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_BOOTTIME, &boottime);
+	blake2s_update(&ss->hash, &realtime, sizeof(realtime));
+	blake2s_update(&ss->hash, &boottime, sizeof(boottime));
+	for (i = 0; i < ARRAY_SIZE(names); ++i) {
+		fd = openat(ss->dfd, names[i], O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		len = read_full(fd, old, sizeof(old));
+		close(fd);
+		if (len > 0) {
+			blake2s_update(&ss->hash, &len, sizeof(len));
+			blake2s_update(&ss->hash, old, len);
+		}
+	}
+	memset(old, 0, sizeof(old));
+
+	ss->len = determine_optimal_seed_len();
+	if (read_new_seed(ss->seed, ss->len, &ss->creditable) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	blake2s_update(&ss->hash, &ss->len, sizeof(ss->len));
+	blake2s_update(&ss->hash, ss->seed, ss->len);
+	hash = ss->hash;
+	blake2s_final(&hash, ss->seed + ss->len - BLAKE2S_HASH_LEN);
+
+	ss->fd = openat(ss->dfd, NON_CREDITABLE_SEED, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0400);
+	if (ss->fd < 0 || write_full(ss->fd, ss->seed, ss->len) != (ssize_t)ss->len || sync_file(ss->fd) < 0 ||
+	    (ss->creditable && renameat(ss->dfd, NON_CREDITABLE_SEED, ss->dfd, CREDITABLE_SEED) < 0) ||
+	    fsync(ss->dfd) < 0)
+		ret = -errno;
+
+out:
+	flock(ss->dfd, LOCK_UN);
+	if (ret && ss->fd >= 0) {
+		close(ss->fd);
+		ss->fd = -1;
+	}
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+/*
+ * Replaces the precomputed seed with fresh material chained onto it,
+ * with one pwrite(2) and one fdatasync(2) of a file that already has
+ * its final name and size.  Fails with ESTALE if another run replaced
+ * the file since, and leaves the precomputed seed in place if no fresh
+ * material can be had.  Fresh material that is not creditable first
+ * takes the credit away from the file, so that the next boot does not
+ * credit it.
+ */
+static int write_shutdown_seed(struct shutdown_seed *ss)
+{
+	const char *name = ss->creditable ? CREDITABLE_SEED : NON_CREDITABLE_SEED;
+	struct timespec realtime, boottime;
+	struct stat open_st, linked_st;
+	bool creditable;
+	int ret = 0;
+
+	if (ss->fd < 0 || flock(ss->dfd, LOCK_EX) < 0)
+		return -1;
+	if (fstat(ss->fd, &open_st) < 0 || fstatat(ss->dfd, name, &linked_st, AT_SYMLINK_NOFOLLOW) < 0 ||
+	    open_st.st_dev != linked_st.st_dev || open_st.st_ino != linked_st.st_ino) {
+		ret = -ESTALE;
+		goto out;
+	}
+	if (read_new_seed(ss->seed, ss->len, &creditable) < 0) {
+		ret = -errno;
+		goto out;
+	}
+	if (ss->creditable && !creditable) {
+		if (renameat(ss->dfd, CREDITABLE_SEED, ss->dfd, NON_CREDITABLE_SEED) < 0 || fsync(ss->dfd) < 0) {
+			ret = -errno;
+			goto out;
+		}
+		ss->creditable = false;
+	}
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	clock_gettime(CLOCK_BOOTTIME, &boottime);
+	blake2s_update(&ss->hash, &realtime, sizeof(realtime));
+	blake2s_update(&ss->hash, &boottime, sizeof(boottime));
+	blake2s_update(&ss->hash, &ss->len, sizeof(ss->len));
+	blake2s_update(&ss->hash, ss->seed, ss->len);
+	blake2s_final(&ss->hash, ss->seed + ss->len - BLAKE2S_HASH_LEN);
+	if (pwrite(ss->fd, ss->seed, ss->len, 0) != (ssize_t)ss->len || fdatasync(ss->fd) < 0)
+		ret = -errno;
+
+out:
+	flock(ss->dfd, LOCK_UN);
+	memset(ss->seed, 0, sizeof(ss->seed));
+	errno = -ret;
+	return ret ? -1 : 0;
+}
+
+enum watch_params {
+	WATCH_TICK_S         = 60,
+	WATCH_HORIZON_S      = 86400 * 365,
+	WATCH_MIN_SUSPEND_MS = 2000,
+	WATCH_DEFAULT_MIN_S  = 300
+};
+
+/* Time spent suspended since boot. */
+static int64_t suspended_ns(void)
+{
+	struct timespec boottime, monotonic;
+
+	clock_gettime(CLOCK_BOOTTIME, &boottime);
+	clock_gettime(CLOCK_MONOTONIC, &monotonic);
+	return timespec_diff_ns(&monotonic, &boottime);
+}
+
+static unsigned long watch_min_interval_s(void)
+{
+	const char *interval = getenv("SEEDRNG_WATCH_MIN_S");
+
+	return interval ? strtoul(interval, NULL, 10) : WATCH_DEFAULT_MIN_S;
+}
+
+/* Arms a real time timer that the kernel cancels whenever it steps the clock. */
+static int arm_clock_set_timer(int fd)
+{
+	struct itimerspec its = { .it_value = { 0 } };
+
+	clock_gettime(CLOCK_REALTIME, &its.it_value);
+	its.it_value.tv_sec += WATCH_HORIZON_S;
+	return timerfd_settime(fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+/*
+ * Stays resident and runs again after every resume from suspend or
+ * hibernation, which leaves both the RNG and the seed file stale.  The
+ * kernel steps the real time clock on resume, which cancels the
+ * TFD_TIMER_CANCEL_ON_SET timer, and a low frequency monotonic timer
+ * catches any resume the first one misses.  Either way, a resume is
+ * only taken for one if CLOCK_BOOTTIME has pulled ahead of
+ * CLOCK_MONOTONIC, by exactly the time spent suspended.  Runs are at
+ * least SEEDRNG_WATCH_MIN_S apart in CLOCK_BOOTTIME, so that a long
+ * suspend always reseeds but a flapping lid does not thrash the disk;
+ * a resume within that interval is served once it has passed.
+ *
+ * With -s, the next-boot seed is also precomputed and written out in
+ * the background, and the SIGTERM sent at shutdown only has to chain
+ * fresh material onto it and overwrite it in place.
+ */
+static int cmd_watch(int argc, char *argv[])
+{
+	struct itimerspec tick = {
+		.it_interval = { .tv_sec = WATCH_TICK_S },
+		.it_value = { .tv_sec = WATCH_TICK_S }
+	};
+	int64_t last_run, last_suspended, suspended, min_interval;
+	struct signalfd_siginfo si;
+	struct pollfd fds[3];
+	bool pending = false, shutdown = false;
+	struct timespec start, end;
+	uint64_t expirations;
+	sigset_t mask;
+	ssize_t len;
+	size_t i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s")) != -1) {
+		switch (opt) {
+		case 's':
+			shutdown = true;
+			break;
+		default:
+			fprintf(stderr, "usage: seedrng watch [-s]\n");
+			return 1;
+		}
+	}
+	if (getuid()) {
+		errno = EACCES;
+		log_perror("This program requires root");
+		return 1;
+	}
+	fds[0].fd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+	fds[1].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fds[0].fd < 0 || fds[1].fd < 0 || arm_clock_set_timer(fds[0].fd) < 0 ||
+	    timerfd_settime(fds[1].fd, 0, &tick, NULL) < 0) {
+		log_perror("Unable to watch for resume");
+		return 1;
+	}
+	fds[2].fd = -1;
+	if (shutdown) {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGTERM);
+		fds[2].fd = signalfd(-1, &mask, SFD_CLOEXEC);
+		if (fds[2].fd < 0 || sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+			log_perror("Unable to watch for shutdown");
+			return 1;
+		}
+		if (mlock(&shutdown_seed, sizeof(shutdown_seed)) < 0)
+			log_perror("Unable to lock shutdown seed in memory");
+	}
+	fds[0].events = fds[1].events = fds[2].events = POLLIN;
+	min_interval = (int64_t)watch_min_interval_s() * 1000000000;
+	last_run = boottime_ns();
+	last_suspended = suspended_ns();
+
+	for (;;) {
+		if (shutdown && shutdown_seed.fd < 0) {
+			set_background(true);
+			if (prepare_shutdown_seed(&shutdown_seed) < 0)
+				log_perror("Unable to precompute shutdown seed");
+			else
+				log_msg(LOG_LEVEL_INFO, "Saved %zu bits of %s seed, ready for shutdown", shutdown_seed.len * 8,
+					shutdown_seed.creditable ? "creditable" : "non-creditable");
+			set_background(false);
+		}
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_perror("Unable to watch for resume");
+			return 1;
+		}
+		if (fds[2].revents && read(fds[2].fd, &si, sizeof(si)) == sizeof(si)) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (write_shutdown_seed(&shutdown_seed) == 0) {
+				clock_gettime(CLOCK_MONOTONIC, &end);
+				log_msg(LOG_LEVEL_INFO, "Saved %zu bits of %s seed for next boot in %.3f ms", shutdown_seed.len * 8,
+					shutdown_seed.creditable ? "creditable" : "non-creditable", timespec_diff_ns(&start, &end) / 1e6);
+				return 0;
+			}
+			log_perror("Unable to write shutdown seed");
+			return errno == ESTALE ? exit_status(run_seedrng(false, false, false)) : 0;
+		}
+		for (i = 0; i < 2; ++i) {
+			if (!fds[i].revents)
+				continue;
+			len = read(fds[i].fd, &expirations, sizeof(expirations));
+			/* Both a clock step and expiry of the horizon need re-arming. */
+			if (i == 0 && (len == sizeof(expirations) || errno == ECANCELED) && arm_clock_set_timer(fds[0].fd) < 0)
+				log_perror("Unable to watch for clock changes");
+		}
+
+		suspended = suspended_ns();
+		if (suspended - last_suspended >= (int64_t)WATCH_MIN_SUSPEND_MS * 1000000) {
+			log_msg(LOG_LEVEL_INFO, "Resumed after %.1f s suspended", (suspended - last_suspended) / 1e9);
+			pending = true;
+		}
+		last_suspended = suspended;
+		if (pending && boottime_ns() - last_run >= min_interval) {
+			run_seedrng(false, false, false);
+			last_run = boottime_ns();
+			pending = false;
+			/* That run replaced the precomputed seed. */
+			if (shutdown_seed.fd >= 0) {
+				close(shutdown_seed.fd);
+				shutdown_seed.fd = -1;
+			}
+		}
+	}
+}
+
+static const struct command {
+	const char *name;
+	int (*fn)(int argc, char *argv[]);
+} commands[] = {
+#ifndef SEEDRNG_NOLIBC
+	{ "provision", cmd_provision },
+	{ "audit",     cmd_audit },
+	{ "serve",     cmd_serve },
+	{ "bench",     cmd_bench },
+#endif
+	{ "history",   cmd_history },
+	{ "commit",    cmd_commit },
+	{ "watch",     cmd_watch },
+};
+
+static void usage(FILE *out)
+{
+	fprintf(out,
+		"usage: seedrng [-d] [-n] [-r] [-t]\n"
+#ifndef SEEDRNG_NOLIBC
+		"       seedrng provision [-j jobs] root...\n"
+		"       seedrng audit [-j jobs] [-s days] [root...]\n"
+		"       seedrng serve [-p seeds] [-s socket]\n"
+		"       seedrng bench [-w]\n"
+#endif
+		"       seedrng history\n"
+		"       seedrng commit\n"
+		"       seedrng watch [-s]\n"
+		"       seedrng -h | -v\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct option longopts[] = {
+		{ "defer",     no_argument, NULL, 'd' },
+		{ "dry-run",   no_argument, NULL, 'n' },
+		{ "resources", no_argument, NULL, 'r' },
+		{ "timings",   no_argument, NULL, 't' },
+		{ "help",      no_argument, NULL, 'h' },
+		{ "version",   no_argument, NULL, 'v' },
+		{ NULL, 0, NULL, 0 }
+	};
+	bool timings = false, resources = false, handoff = false;
+	size_t i;
+	int opt;
+
+	umask(0077);
+	config = default_config;
+	for (i = 0; argc > 1 && i < ARRAY_SIZE(commands); ++i) {
+		if (!strcmp(argv[1], commands[i].name))
+			return commands[i].fn(argc - 1, argv + 1);
+	}
+	while ((opt = getopt_long(argc, argv, "dnrthv", longopts, NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			handoff = true;
+			break;
+		case 'n':
+			dry_run = timings = true;
+			break;
+		case 'r':
+			resources = timings = true;
+			break;
+		case 't':
+			timings = true;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		case 'v':
+			printf("seedrng %s\n", VERSION);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind < argc) {
+		usage(stderr);
+		return 1;
+	}
+	if (getuid()) {
+		errno = EACCES;
+		log_perror("This program requires root");
+		return 1;
+	}
+
+	return exit_status(run_seedrng(timings, resources, handoff));
+}